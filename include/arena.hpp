@@ -0,0 +1,358 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace kvstore {
+
+/**
+ * @brief How an Arena backs its mappings with huge pages
+ */
+enum class HugePages {
+    Off,         // Regular 4 KB pages
+    Transparent, // Regular mappings advised for transparent huge pages (MADV_HUGEPAGE)
+    Explicit     // Reserved hugetlb pages (MAP_HUGETLB), falling back to Transparent when none are free
+};
+
+/**
+ * @brief Configuration for an Arena
+ */
+struct ArenaOptions {
+    // NUMA node whose memory backs the arena (-1 = kernel default, first touch)
+    int numa_node = -1;
+
+    // Size of each slab page, rounded up to a power of two; allocations above page_size / 8
+    // get their own mapping. With huge pages enabled, slab pages are exactly 2 MB.
+    size_t page_size = 256 * 1024;
+
+    HugePages huge_pages = HugePages::Off;
+
+    // Huge page size for HugePages::Explicit: 2 MB or 1 GB (other values throw
+    // std::invalid_argument). 1 GB pages back only allocations of 1 GB or more; slab pages
+    // then use transparent 2 MB pages rather than a whole 1 GB page per size class.
+    size_t huge_page_size = 2 * 1024 * 1024;
+};
+
+/**
+ * @brief Thread-safe slab allocator over pages mapped directly from the OS.
+ *
+ * Small allocations are rounded up to a size class and carved from pages dedicated to
+ * that class; a page is unmapped again once its last slot is freed. Because pages come
+ * from mmap rather than malloc, they can be bound to a NUMA node before first touch, so
+ * an arena places everything allocated from it on one node regardless of which thread
+ * allocates. Pages can also be backed by 2 MB / 1 GB huge pages so random lookups over a
+ * large store touch far fewer TLB entries. All slots are 16-byte aligned.
+ */
+class Arena {
+public:
+    explicit Arena(const ArenaOptions& options = ArenaOptions());
+
+    /**
+     * @brief Unmap every slab page
+     * 
+     * Large allocations (which get their own mapping) must have been freed.
+     */
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * @brief Allocate at least @p size bytes
+     * 
+     * @throws std::bad_alloc if the OS refuses a new mapping
+     */
+    void* allocate(size_t size);
+
+    /**
+     * @brief Free an allocation; @p size must match the size passed to allocate()
+     */
+    void deallocate(void* ptr, size_t size) noexcept;
+
+    /**
+     * @brief Bytes currently handed out, rounded up to size classes
+     */
+    size_t allocated_bytes() const;
+
+    /**
+     * @brief Bytes currently mapped from the OS
+     */
+    size_t mapped_bytes() const;
+
+    /**
+     * @brief Bytes currently mapped from reserved hugetlb pages (HugePages::Explicit only)
+     */
+    size_t huge_page_bytes() const;
+
+    /**
+     * @brief Whether moving an allocation would help compact the arena
+     * 
+     * True for a slab slot on a page that is less full than its size class on average and
+     * is not the page new allocations are carved from, so a fresh allocate() of the same
+     * size lands on a denser page and the sparse one can drain and be unmapped. Copying the
+     * bytes and freeing the old slot is up to the caller.
+     */
+    bool should_relocate(const void* ptr, size_t size) const;
+
+    /**
+     * @brief Unmap slab pages kept around with no live slots
+     * 
+     * @return size_t Bytes returned to the OS
+     */
+    size_t trim();
+
+    /**
+     * @brief NUMA node the arena is bound to (-1 if unbound)
+     */
+    int numa_node() const {
+        return options_.numa_node;
+    }
+
+    /**
+     * @brief Huge page mode the arena was created with
+     */
+    HugePages huge_pages() const {
+        return options_.huge_pages;
+    }
+
+private:
+    // Header at the start of every slab page
+    struct Page {
+        Page* prev = nullptr;       // Links in the size class's partial list
+        Page* next = nullptr;
+        Page* all_prev = nullptr;   // Links in the list of every page
+        Page* all_next = nullptr;
+        void* free_list = nullptr;  // Freed slots, linked through their first word
+        char* bump = nullptr;       // Next never-used slot
+        char* end = nullptr;
+        uint32_t live = 0;
+        uint32_t capacity = 0;
+        uint32_t size_class = 0;
+        bool in_partial = false;
+        bool huge = false;          // Backed by hugetlb pages
+    };
+
+    struct SizeClass {
+        size_t slot_size = 0;
+        Page* partial = nullptr; // Pages with at least one free slot
+        size_t live = 0;         // Slots in use across the class's pages
+        size_t capacity = 0;     // Slots across the class's pages
+    };
+
+    ArenaOptions options_;
+    size_t header_size_;
+    size_t max_small_size_;
+
+    mutable std::mutex mutex_;
+    std::vector<SizeClass> classes_;
+    std::vector<uint8_t> class_lookup_; // (size + 15) / 16 -> class index
+
+    size_t allocated_bytes_ = 0;
+    size_t mapped_bytes_ = 0;
+    size_t huge_page_bytes_ = 0;
+    Page* all_pages_ = nullptr;
+    std::unordered_map<void*, size_t> huge_large_; // Large allocations backed by hugetlb pages
+
+    size_t size_class_of(size_t size) const {
+        return class_lookup_[(size + 15) / 16];
+    }
+
+    /**
+     * @brief Mapping length for an allocation too large for the slab classes
+     */
+    size_t large_length(size_t size) const;
+
+    /**
+     * @brief Map an aligned region of @p length bytes, bound to the arena's node
+     * 
+     * Uses hugetlb pages when configured and @p length is a whole number of huge pages.
+     * 
+     * @param huge Set to whether the mapping is backed by hugetlb pages
+     */
+    void* map(size_t length, size_t alignment, bool& huge);
+
+    /**
+     * @brief Unmap a region returned by map() and update the accounting (mutex_ must be held)
+     */
+    void unmap(void* ptr, size_t length, bool huge);
+
+    /**
+     * @brief Map and initialize a new slab page for a size class (mutex_ must be held)
+     */
+    Page* new_page(size_t size_class);
+
+    /**
+     * @brief Unlink and unmap an empty slab page (mutex_ must be held)
+     */
+    void release_page(Page* page);
+
+    void link_partial(Page* page);
+    void unlink_partial(Page* page);
+};
+
+/**
+ * @brief Standard allocator adaptor so containers can place their nodes in an Arena
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit ArenaAllocator(Arena* arena) noexcept : arena_(arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        arena_->deallocate(ptr, n * sizeof(T));
+    }
+
+    Arena* arena() const noexcept {
+        return arena_;
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept {
+        return arena_ == other.arena();
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept {
+        return arena_ != other.arena();
+    }
+
+private:
+    Arena* arena_;
+};
+
+/**
+ * @brief An owned byte string whose storage lives in an Arena (move-only)
+ *
+ * Strings of up to kInlineCapacity bytes are stored inside the object itself, so a short
+ * key or value embedded in an index node needs no separate allocation and is read from
+ * the node's own cache lines. Longer strings are allocated from the arena.
+ */
+class ArenaBuffer {
+public:
+    static constexpr size_t kInlineCapacity = 23;
+
+    ArenaBuffer() noexcept {
+        set_inline_size(0);
+    }
+
+    /**
+     * @brief Copy @p size bytes from @p data, inline or into a new allocation from @p arena
+     */
+    ArenaBuffer(Arena& arena, const char* data, size_t size);
+
+    /**
+     * @brief A non-owning buffer over existing bytes, for looking up ArenaBuffer keys
+     * 
+     * The bytes must outlive the returned buffer; it is never freed.
+     */
+    static ArenaBuffer borrow(const char* data, size_t size) noexcept;
+
+    ArenaBuffer(ArenaBuffer&& other) noexcept;
+    ArenaBuffer& operator=(ArenaBuffer&& other) noexcept;
+    ArenaBuffer(const ArenaBuffer&) = delete;
+    ArenaBuffer& operator=(const ArenaBuffer&) = delete;
+
+    ~ArenaBuffer() {
+        reset();
+    }
+
+    const char* data() const {
+        return is_inline() ? bytes_ : load<const char*>(kDataOffset);
+    }
+
+    size_t size() const {
+        return is_inline() ? kInlineCapacity - tag() : load<size_t>(kSizeOffset) & kSizeMask;
+    }
+
+    /**
+     * @brief Whether the bytes are stored inside the object rather than in the arena
+     */
+    bool is_inline() const {
+        return tag() <= kInlineCapacity;
+    }
+
+    std::string_view view() const {
+        return std::string_view(data(), size());
+    }
+
+    /**
+     * @brief Copy the bytes out into a std::string
+     */
+    std::string str() const {
+        return std::string(data(), size());
+    }
+
+    bool operator==(const ArenaBuffer& other) const {
+        return view() == other.view();
+    }
+
+    /**
+     * @brief Free the storage, leaving the buffer empty
+     */
+    void reset() noexcept;
+
+private:
+    // Inline: bytes 0-22 hold the data and byte 23 is kInlineCapacity - size, which is
+    // also the terminating zero when full. Out of line: a data pointer, the owning arena
+    // (null when borrowed) and the size in the low 56 bits of the last word, whose top
+    // byte holds kOutOfLineTag.
+    static constexpr size_t kDataOffset = 0;
+    static constexpr size_t kArenaOffset = 8;
+    static constexpr size_t kSizeOffset = 16;
+    static constexpr size_t kTagOffset = 23;
+    static constexpr uint8_t kOutOfLineTag = 0x80;
+    static constexpr size_t kSizeMask = (size_t(1) << 56) - 1;
+
+    alignas(8) char bytes_[24];
+
+    uint8_t tag() const {
+        return static_cast<uint8_t>(bytes_[kTagOffset]);
+    }
+
+    void set_inline_size(size_t size) {
+        bytes_[kTagOffset] = static_cast<char>(kInlineCapacity - size);
+    }
+
+    void set_out_of_line(const char* data, Arena* arena, size_t size);
+
+    template <typename T>
+    T load(size_t offset) const {
+        T value;
+        std::memcpy(&value, bytes_ + offset, sizeof(T));
+        return value;
+    }
+};
+
+/**
+ * @brief Hash for ArenaBuffer keys, consistent with std::hash<std::string_view>
+ */
+struct ArenaBufferHash {
+    size_t operator()(const ArenaBuffer& buffer) const noexcept {
+        return std::hash<std::string_view>()(buffer.view());
+    }
+};
+
+} // namespace kvstore
+
+#endif // ARENA_HPP
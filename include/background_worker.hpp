@@ -0,0 +1,58 @@
+#ifndef BACKGROUND_WORKER_HPP
+#define BACKGROUND_WORKER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace kvstore {
+
+/**
+ * @brief A single background thread that runs queued tasks in submission order.
+ *
+ * Used by KVStore to move work such as stale-entry refreshes off the request path.
+ * The thread is started lazily on the first submit().
+ */
+class BackgroundWorker {
+public:
+    /**
+     * @brief Construct a worker
+     * 
+     * @param numa_node NUMA node whose CPUs the thread is pinned to (-1 = no pinning)
+     */
+    explicit BackgroundWorker(int numa_node = -1) : numa_node_(numa_node) {}
+
+    /**
+     * @brief Run all pending tasks, then stop and join the thread
+     */
+    ~BackgroundWorker();
+
+    BackgroundWorker(const BackgroundWorker&) = delete;
+    BackgroundWorker& operator=(const BackgroundWorker&) = delete;
+
+    /**
+     * @brief Queue a task to run on the background thread
+     *
+     * @param task The task to run; exceptions thrown by it are swallowed
+     */
+    void submit(std::function<void()> task);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    int numa_node_;
+    std::thread thread_;
+
+    /**
+     * @brief Thread body: pop and run tasks until stopped and drained
+     */
+    void run();
+};
+
+} // namespace kvstore
+
+#endif // BACKGROUND_WORKER_HPP
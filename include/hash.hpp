@@ -0,0 +1,45 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace kvstore {
+
+/**
+ * @brief 64-bit MurmurHash64A of a byte string
+ *
+ * Stable across processes and builds (unlike std::hash), so it can key structures that
+ * outlive the process or are shared with other ones. Different seeds give independent
+ * hashes of the same input.
+ */
+inline uint64_t hash64(const char* data, size_t size, uint64_t seed) {
+    const uint64_t m = 0xC6A4A7935BD1E995ull;
+    uint64_t h = seed ^ (size * m);
+    const char* end = data + (size & ~size_t(7));
+    for (; data != end; data += 8) {
+        uint64_t k;
+        std::memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    size_t tail = size & 7;
+    if (tail > 0) {
+        uint64_t k = 0;
+        std::memcpy(&k, data, tail);
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+} // namespace kvstore
+
+#endif // HASH_HPP
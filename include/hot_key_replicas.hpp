@@ -0,0 +1,111 @@
+#ifndef HOT_KEY_REPLICAS_HPP
+#define HOT_KEY_REPLICAS_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace kvstore {
+
+/**
+ * @brief Per-core read-only copies of a small set of hot keys.
+ *
+ * Each slot holds its own copy of every replicated value behind its own lock, and a
+ * reader only touches the slot of the CPU it is running on, so reads of a celebrity key
+ * no longer serialize on the store-wide mutex. Writers (the owning store, which
+ * serializes install/invalidate/clear) update every slot.
+ */
+class HotKeyReplicas {
+public:
+    /**
+     * @brief Construct the replica slots
+     * 
+     * @param slots Number of per-core slots (0 = one per hardware thread)
+     */
+    explicit HotKeyReplicas(size_t slots = 0);
+
+    /**
+     * @brief Read a replicated value from the calling CPU's slot
+     * 
+     * @param key The key to look up
+     * @return std::optional<std::string> The value, or std::nullopt if the key is not replicated
+     */
+    std::optional<std::string> get(const std::string& key) const;
+
+    /**
+     * @brief Whether any key is currently replicated (cheap pre-check for get())
+     */
+    bool empty() const {
+        return count_.load(std::memory_order_acquire) == 0;
+    }
+
+    /**
+     * @brief Whether a key is replicated (owner-serialized)
+     */
+    bool contains(const std::string& key) const {
+        return keys_.count(key) > 0;
+    }
+
+    /**
+     * @brief Get the replicated keys (owner-serialized)
+     */
+    const std::unordered_set<std::string>& keys() const {
+        return keys_;
+    }
+
+    /**
+     * @brief Copy a value into every slot (owner-serialized)
+     */
+    void install(const std::string& key, const std::string& value);
+
+    /**
+     * @brief Remove a key from every slot, if replicated (owner-serialized)
+     */
+    void invalidate(const std::string& key);
+
+    /**
+     * @brief Remove every replicated key (owner-serialized)
+     */
+    void clear();
+
+    /**
+     * @brief Collect the reads each replicated key has served since the last call (owner-serialized)
+     * 
+     * Replica reads bypass the store's hot-key tracker; the owner feeds these counts back
+     * so a key stays replicated only while it is still being read.
+     */
+    std::unordered_map<std::string, uint64_t> take_hits();
+
+private:
+    struct Replica {
+        std::shared_ptr<const std::string> value;
+        uint64_t hits = 0;
+    };
+
+    // One slot per core, padded to its own cache lines
+    struct alignas(64) Slot {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Replica> values;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slot_count_;
+
+    // Replicated key set, maintained by the owner; count_ mirrors its size for readers
+    std::unordered_set<std::string> keys_;
+    std::atomic<size_t> count_{0};
+
+    /**
+     * @brief Slot for the CPU the caller is running on
+     */
+    Slot& local_slot() const;
+};
+
+} // namespace kvstore
+
+#endif // HOT_KEY_REPLICAS_HPP
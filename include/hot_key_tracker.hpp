@@ -0,0 +1,105 @@
+#ifndef HOT_KEY_TRACKER_HPP
+#define HOT_KEY_TRACKER_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kvstore {
+
+/**
+ * @brief A heavy-hitter estimate reported by HotKeyTracker
+ */
+struct HotKey {
+    std::string key;
+    uint64_t count = 0; // Estimated accesses (an overestimate by at most error)
+    uint64_t error = 0; // Maximum overestimation inherited from the evicted counter
+};
+
+/**
+ * @brief Sampled top-K heavy-hitter tracker using the space-saving algorithm.
+ *
+ * Keeps a fixed number of counters. A sampled key that is not tracked takes over the
+ * counter with the smallest count and inherits that count as its error bound, so every
+ * key accessed more than (total / capacity) times is guaranteed to be tracked.
+ * Only one in sample_rate accesses on average is counted (each weighted by sample_rate)
+ * to keep the per-operation overhead to a decrement on the unsampled path. Gaps between
+ * samples are randomized so periodic access patterns are not aliased.
+ *
+ * Not internally synchronized: the owner serializes calls.
+ */
+class HotKeyTracker {
+public:
+    /**
+     * @brief Construct a tracker
+     * 
+     * @param capacity Number of counters (0 disables tracking)
+     * @param sample_rate Count one in this many accesses (1 counts every access)
+     */
+    explicit HotKeyTracker(size_t capacity = 64, uint32_t sample_rate = 16);
+
+    /**
+     * @brief Record one access to a key
+     * 
+     * @param key The key accessed
+     */
+    void record(const std::string& key) {
+        if (capacity_ == 0 || --countdown_ > 0) {
+            return;
+        }
+        countdown_ = next_gap();
+        record_sampled(key);
+    }
+
+    /**
+     * @brief Get the hottest keys by estimated count
+     * 
+     * @param k Maximum number of keys to return
+     * @return std::vector<HotKey> Up to k keys, hottest first
+     */
+    std::vector<HotKey> top(size_t k) const;
+
+    /**
+     * @brief Count accesses to a key that were observed outside record() (e.g. replica reads)
+     * 
+     * @param key The key accessed
+     * @param count Number of accesses, counted in full rather than sampled
+     */
+    void add(const std::string& key, uint64_t count);
+
+    /**
+     * @brief Halve every count and error, so keys that cooled off fall behind current ones
+     */
+    void decay();
+
+    /**
+     * @brief Forget all counters
+     */
+    void clear();
+
+private:
+    size_t capacity_;
+    uint32_t sample_rate_;
+    uint32_t countdown_ = 1;
+    uint32_t rng_state_ = 0x9e3779b9;
+
+    std::vector<HotKey> counters_;
+    std::unordered_map<std::string, size_t> index_; // Key -> position in counters_
+
+    /**
+     * @brief Draw the number of accesses until the next sample (uniform over [1, 2 * sample_rate - 1])
+     */
+    uint32_t next_gap();
+
+    /**
+     * @brief Count a sampled access with weight sample_rate_
+     */
+    void record_sampled(const std::string& key) {
+        add(key, sample_rate_);
+    }
+};
+
+} // namespace kvstore
+
+#endif // HOT_KEY_TRACKER_HPP
@@ -0,0 +1,83 @@
+#ifndef KEY_FILTER_HPP
+#define KEY_FILTER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace kvstore {
+
+/**
+ * @brief Blocked counting Bloom filter over the keys present in a store.
+ *
+ * Each key hashes to one 64-byte block of 128 four-bit counters and bumps 7 of them, so
+ * a query touches a single cache line. Counters saturate at 15 and then stay put, which
+ * keeps remove() from ever producing a false negative. At 10 counters per expected key
+ * the false-positive rate is about 1%.
+ *
+ * clear() is O(1): it starts a new generation, blocks last written in an earlier one
+ * read as empty, and add() zeroes such a block before counting into it.
+ *
+ * may_contain() is safe to call from any thread without a lock; add(), remove() and
+ * clear() must be serialized by the owner.
+ */
+class KeyFilter {
+public:
+    /**
+     * @brief Construct an empty filter
+     *
+     * @param expected_keys Number of keys the filter is sized for
+     */
+    explicit KeyFilter(size_t expected_keys);
+
+    /**
+     * @brief Whether a key with this hash may be present (false means definitely absent)
+     */
+    bool may_contain(uint64_t hash) const;
+
+    /**
+     * @brief Count one key with this hash (owner-serialized)
+     */
+    void add(uint64_t hash);
+
+    /**
+     * @brief Uncount one key previously added with this hash (owner-serialized)
+     */
+    void remove(uint64_t hash);
+
+    /**
+     * @brief Reset every counter in O(1) by starting a new generation (owner-serialized)
+     */
+    void clear();
+
+    /**
+     * @brief Bytes of counter storage
+     */
+    size_t memory_bytes() const {
+        return block_count_ * (sizeof(Block) + sizeof(std::atomic<uint32_t>));
+    }
+
+private:
+    static constexpr int kProbes = 7;
+
+    struct alignas(64) Block {
+        std::atomic<uint8_t> bytes[64]; // Two counters per byte, low nibble first
+    };
+
+    std::unique_ptr<Block[]> blocks_;
+    std::unique_ptr<std::atomic<uint32_t>[]> generations_; // Generation each block was last written in
+    size_t block_count_;
+    std::atomic<uint32_t> generation_{1};
+
+    /**
+     * @brief Add @p delta to every counter @p hash maps to, leaving saturated ones alone
+     */
+    void update(uint64_t hash, int delta);
+
+    size_t block_index(uint64_t hash) const;
+};
+
+} // namespace kvstore
+
+#endif // KEY_FILTER_HPP
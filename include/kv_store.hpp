@@ -5,23 +5,249 @@
 #include <unordered_map>
 #include <list>
 #include <mutex>
+#include <condition_variable>
 #include <optional>
 #include <fstream>
 #include <memory>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "arena.hpp"
+#include "background_worker.hpp"
+#include "hot_key_tracker.hpp"
+#include "hot_key_replicas.hpp"
+#include "key_filter.hpp"
+#include "mapped_table.hpp"
+#include "wal_writer.hpp"
+#include "lz4.hpp"
 
 namespace kvstore {
 
+/**
+ * @brief Per-entry options for KVStore::put()
+ *
+ * A zero TTL disables the corresponding expiry. Once the soft TTL has passed the entry
+ * is stale: get() keeps serving it while the registered refresher reloads it in the
+ * background. Once the hard TTL has passed the entry is treated as absent.
+ */
+struct PutOptions {
+    std::chrono::milliseconds soft_ttl{0};
+    std::chrono::milliseconds hard_ttl{0};
+
+    // Relative cost of re-fetching the value (e.g. backend latency); used by GDSF eviction
+    double cost = 1.0;
+};
+
+/**
+ * @brief Policy used to pick an eviction victim when the store is over budget
+ */
+enum class EvictionPolicy {
+    LRU,  // Least recently used entry
+    GDSF  // GreedyDual-Size-Frequency: lowest (frequency * cost / size), aged by an inflation clock
+};
+
+/**
+ * @brief Construction-time configuration for KVStore (and for each namespace)
+ */
+struct StoreOptions {
+    // Maximum number of key-value pairs to store
+    size_t max_capacity = 1000;
+
+    // Maximum approximate memory footprint in bytes (0 disables the byte budget)
+    size_t max_bytes = 0;
+
+    EvictionPolicy eviction_policy = EvictionPolicy::LRU;
+
+    // Path to the write-ahead log file (empty string disables WAL)
+    std::string wal_path;
+
+    WalDurability wal_durability = WalDurability::Flush;
+
+    // Split the WAL into preallocated segments of this many bytes, recycled after each
+    // checkpoint() (0 keeps a single, ever-growing file)
+    size_t wal_segment_size = 0;
+
+    // Write the WAL with O_DIRECT in framed 4 KB blocks, double-buffered, so it never
+    // fills the page cache (falls back to buffered I/O, with a warning, where unsupported).
+    // A single-file log written with the other setting is not opened
+    bool wal_direct_io = false;
+
+    // Evict on a background thread: once usage passes high_watermark (a fraction of
+    // max_capacity / max_bytes) the reclaimer evicts down to low_watermark. put() only
+    // evicts inline as a fallback when the hard budget itself is exceeded.
+    bool background_eviction = false;
+    double high_watermark = 0.9;
+    double low_watermark = 0.8;
+
+    // Values at least this large are freed on the background thread (0 disables)
+    size_t lazy_free_threshold = 64 * 1024;
+
+    // Active defrag: once the arena maps more than defrag_threshold times the bytes it has
+    // handed out, the background thread moves values off sparse slab pages in slices of at
+    // most defrag_slice (holding the store lock), so emptied pages go back to the OS
+    bool active_defrag = false;
+    double defrag_threshold = 1.3;
+    std::chrono::microseconds defrag_slice{1000};
+
+    // Cold tier: keep the least recently used cold_fraction of entries LZ4-compressed.
+    // Writes compress entries as they drift past the boundary; an access decompresses the
+    // entry and promotes it back to the hot end. Byte budgets charge the compressed size.
+    bool compress_cold = false;
+    double cold_fraction = 0.5;
+
+    // Compress every value on write, against the dictionary from train_dictionary() once
+    // there is one. Suits many small, similar values (JSON records) that do not compress
+    // on their own; reads decompress straight into the returned string.
+    bool compress_values = false;
+
+    // Store identical values once: values longer than ArenaBuffer::kInlineCapacity are
+    // kept in a content-addressed pool (matched by hash, then compared byte for byte) and
+    // reference counted; byte budgets charge a shared value once
+    bool dedup_values = false;
+
+    // Index keys by a 64-bit fingerprint instead of the key bytes, for pure caches whose
+    // keys dominate memory: every key then fits inline in the hash node. Two keys with
+    // the same fingerprint (about n^2 / 2^65 odds for n keys) alias one entry, so a get
+    // may return the other key's value. fingerprint_checksum adds an independent 32-bit
+    // check to the fingerprint, cutting those odds by a further 2^32 at no index cost.
+    bool fingerprint_keys = false;
+    bool fingerprint_checksum = false;
+
+    // Keep a counting Bloom filter over the present keys (sized for max_capacity, about
+    // 5 bytes per key) so get() and exists() on keys that were never stored answer
+    // without the store lock or an index probe
+    bool key_filter = false;
+
+    // NUMA node this store is bound to (-1 = no placement). Index nodes and values are
+    // allocated from an arena bound to the node and background work runs on its CPUs.
+    // Bind one namespace per node to partition a dataset across sockets.
+    int numa_node = -1;
+
+    // Back the store's arena with huge pages so random lookups over a large index touch
+    // fewer TLB entries. Explicit uses reserved hugetlb pages of huge_page_size (2 MB or
+    // 1 GB; other values throw std::invalid_argument) and falls back to transparent huge
+    // pages when none are free. Slab pages are 2 MB either way, so 1 GB pages only back
+    // values of 1 GB or more.
+    HugePages huge_pages = HugePages::Off;
+    size_t huge_page_size = 2 * 1024 * 1024;
+
+    // Heavy-hitter tracking over get/put traffic: number of counters (0 disables)
+    // and the fraction of operations sampled (one in hot_key_sample_rate)
+    size_t hot_key_capacity = 64;
+    uint32_t hot_key_sample_rate = 16;
+
+    // Serve the hottest keys from per-core read-only replicas that get() reads without
+    // the store lock; replicas are invalidated by any write to the key
+    bool hot_key_replication = false;
+    size_t replicated_hot_keys = 8;
+
+    // Publish every entry to a POSIX shared-memory table of that name (empty disables),
+    // which other local processes read lock-free through MappedTable::open_shared(). This
+    // store is its only writer. Entries whose key and value do not fit a slot (slot size
+    // minus 32 bytes) stay private. Not available with fingerprint_keys.
+    std::string shared_memory_name = "";
+    size_t shared_memory_slots = 64 * 1024;
+    size_t shared_memory_slot_size = 256;
+
+    // Keep every entry in a crash-consistent memory-mapped file as well (empty disables).
+    // Reopening the file is O(1): nothing is replayed, and keys missing from memory are
+    // faulted in from it on first access, so the in-memory index acts as a cache over
+    // the file and evictions leave the file alone. The file has persistent_slots slots
+    // of persistent_slot_size bytes. A slot holds a key and value of up to
+    // persistent_slot_size - 40 bytes together (216 by default); larger entries are not
+    // split across slots. An entry the file cannot take (too large, or no free slot near
+    // its hash) is kept in memory only and is lost on eviction or restart: put() returns
+    // false for it, the first one prints a warning, and stats() counts them all.
+    // persistent_sync msyncs each update before put() or del() returns. Not available
+    // with key_filter, whose view of absent keys would not cover the file.
+    std::string persistent_path = "";
+    size_t persistent_slots = 1024 * 1024;
+    size_t persistent_slot_size = 256;
+    bool persistent_sync = true;
+};
+
+/**
+ * @brief Point-in-time counters reported by KVStore::stats()
+ */
+struct StoreStats {
+    size_t entries = 0;
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    // Hits served from hot-key replicas (included in hits)
+    uint64_t replica_hits = 0;
+
+    // Misses answered by the key filter without the lock (included in misses)
+    uint64_t filtered_misses = 0;
+
+    // Entries published to the shared-memory table
+    size_t shared_memory_entries = 0;
+
+    // Entries in the persistent file, entries faulted in from it on a memory miss, and
+    // writes it could not take (entry too large for a slot, or no free slot near its hash)
+    size_t persistent_entries = 0;
+    uint64_t persistent_faults = 0;
+    uint64_t persistent_write_failures = 0;
+
+    // Whether a WAL write, sync or segment open has failed, so the log may be missing records
+    bool wal_failed = false;
+
+    // Keys whose last WAL record recover_async() has not replayed yet
+    size_t recovery_pending_keys = 0;
+
+    // Entries copied aside because they changed while a snapshot was being written
+    uint64_t snapshot_cow_copies = 0;
+
+    // Arena bytes handed out and mapped from the OS (shared with namespaces on the same
+    // arena), and values and index nodes moved by active defrag
+    size_t arena_allocated_bytes = 0;
+    size_t arena_mapped_bytes = 0;
+    uint64_t defrag_moves = 0;
+
+    // Entries in the compressed cold tier and the bytes compression saves on them
+    size_t cold_entries = 0;
+    size_t cold_bytes_saved = 0;
+
+    // Bytes compression saves across all entries, and the current dictionary (0 = none)
+    size_t compressed_bytes_saved = 0;
+    uint32_t dictionary_version = 0;
+
+    // Distinct values in the dedup pool, and bytes saved by sharing them
+    size_t shared_values = 0;
+    size_t dedup_bytes_saved = 0;
+
+    // Hottest keys by estimated access count, hottest first
+    std::vector<HotKey> hot_keys;
+};
+
 /**
  * @brief A thread-safe, in-memory key-value store with LRU cache eviction and WAL support.
  * 
  * Features:
  * - O(1) get/put/delete operations using hash-based indexing
- * - LRU (Least Recently Used) eviction policy with configurable capacity
+ * - LRU (Least Recently Used) or GDSF (cost- and size-aware) eviction with entry and byte budgets
  * - Thread-safe operations using mutex-based locking
  * - Write-Ahead Logging (WAL) for durability
+ * - Soft/hard TTLs with stale-while-revalidate background refresh
+ * - Named namespaces, each an independent KVStore sharing this store's background thread
+ * - Index nodes and values allocated from a slab arena, optionally bound to a NUMA node
  */
 class KVStore {
 public:
+    /**
+     * @brief Backend fetch used to populate the store on a miss
+     *
+     * Returns the value for the key, or std::nullopt if the backend has no such key.
+     */
+    using Loader = std::function<std::optional<std::string>(const std::string& key)>;
+
     /**
      * @brief Construct a new KVStore object
      * 
@@ -30,8 +256,19 @@ public:
      */
     explicit KVStore(size_t max_capacity = 1000, const std::string& wal_path = "");
 
+    /**
+     * @brief Construct a new KVStore object from a full configuration
+     * 
+     * @param options Capacity, byte budget, eviction policy and WAL settings
+     */
+    explicit KVStore(const StoreOptions& options);
+
     /**
      * @brief Destroy the KVStore object and close WAL file
+     * 
+     * A large index is torn down on the background worker. A namespace shares its parent's
+     * worker, so dropping one returns promptly; the worker itself is drained and joined when
+     * the last store using it is destroyed, so no teardown outlives the stores.
      */
     ~KVStore();
 
@@ -40,18 +277,62 @@ public:
      * 
      * @param key The key to store
      * @param value The value to associate with the key
-     * @return true if operation succeeded
+     * @param options TTLs and re-fetch cost hint for the entry
+     * @return true if operation succeeded; false if the persistent file could not take the
+     *         entry, which is then served from memory only and lost once evicted
      */
-    bool put(const std::string& key, const std::string& value);
+    bool put(const std::string& key, const std::string& value, const PutOptions& options = PutOptions());
 
     /**
      * @brief Retrieve a value by key
      * 
+     * A stale entry (past its soft TTL) is still returned, and triggers at most one
+     * background refresh through the registered refresher.
+     * 
      * @param key The key to look up
      * @return std::optional<std::string> The value if found, std::nullopt otherwise
      */
     std::optional<std::string> get(const std::string& key);
 
+    /**
+     * @brief Retrieve a value by key, loading it from a backend on a miss
+     *
+     * Concurrent misses on the same key are coalesced: exactly one caller runs the
+     * loader while the others wait for its result. A loaded value is inserted via put().
+     * If the loader throws, every waiting caller sees the same exception.
+     *
+     * @param key The key to look up
+     * @param loader Backend fetch invoked (without the store lock held) on a miss
+     * @param options TTLs applied to a loaded value
+     * @return std::optional<std::string> The cached or loaded value, std::nullopt if the loader found nothing
+     */
+    std::optional<std::string> get_or_load(const std::string& key, const Loader& loader,
+                                           const PutOptions& options = PutOptions());
+
+    /**
+     * @brief Register the backend fetch used to refresh stale entries
+     *
+     * Refreshes run on a background thread, at most one at a time per key. If the
+     * refresher returns std::nullopt or throws, the stale value keeps being served
+     * until its hard TTL passes. An empty refresher disables background refresh.
+     *
+     * @param refresher The backend fetch to call with the stale key
+     */
+    void set_refresher(Loader refresher);
+
+    /**
+     * @brief Configure the negative cache of keys a loader recently reported absent
+     *
+     * While a key is negatively cached, get_or_load() returns std::nullopt without
+     * calling the loader. Entries expire after @p ttl, the oldest is dropped once
+     * @p capacity is reached, and any put() of the key removes it. A zero capacity
+     * (the default) disables negative caching.
+     *
+     * @param capacity Maximum number of absent keys remembered
+     * @param ttl How long an absent key is remembered
+     */
+    void set_negative_cache(size_t capacity, std::chrono::milliseconds ttl);
+
     /**
      * @brief Delete a key-value pair
      * 
@@ -63,6 +344,8 @@ public:
     /**
      * @brief Check if a key exists in the store
      * 
+     * Entries past their hard TTL are reported as absent.
+     * 
      * @param key The key to check
      * @return true if the key exists, false otherwise
      */
@@ -71,12 +354,49 @@ public:
     /**
      * @brief Get the current number of key-value pairs stored
      * 
+     * Expired entries are removed lazily, so they count until next accessed or evicted.
+     * 
      * @return size_t Number of entries
      */
     size_t size() const;
 
+    /**
+     * @brief Get the approximate memory footprint of all entries
+     * 
+     * Counts key and value bytes plus a fixed per-entry bookkeeping overhead; this is
+     * the quantity bounded by StoreOptions::max_bytes.
+     * 
+     * @return size_t Bytes in use
+     */
+    size_t memory_usage() const;
+
+    /**
+     * @brief Get hit/miss/eviction counters and the current hot keys
+     * 
+     * @param top_k Maximum number of hot keys to report
+     * @return StoreStats A snapshot of the store's counters
+     */
+    StoreStats stats(size_t top_k = 10) const;
+
+    /**
+     * @brief Train a compression dictionary from a sample of the store's values
+     * 
+     * Values are sampled from the hot end of the LRU list and training runs without the
+     * lock held. The new dictionary becomes the current version: later writes and cold-tier
+     * compression use it, while values already compressed keep the version they were
+     * written with, which is retained until none remain. The dictionary is logged to the
+     * WAL ahead of any record compressed against it, so recover() can decode them.
+     * 
+     * @param max_size Dictionary size limit in bytes (at most 64 KB is used)
+     * @return uint32_t The new dictionary version, or 0 if there was nothing to sample
+     */
+    uint32_t train_dictionary(size_t max_size = 16 * 1024);
+
     /**
      * @brief Clear all key-value pairs from the store
+     * 
+     * The index is swapped for an empty one in O(1) under the lock; the old entries
+     * are destroyed afterwards, on the background thread when there are many of them.
      */
     void clear();
 
@@ -87,44 +407,678 @@ public:
      */
     bool recover();
 
+    /**
+     * @brief Recover from the write-ahead log while serving requests
+     * 
+     * Scans the log once for the last record of each key, without decoding any value and
+     * without holding the store lock, installs that index in one step, then returns and
+     * replays the log on the background thread. A request for a key
+     * whose last record has not been replayed yet applies that one record first; every
+     * other key is served at once. Like recover(), call it before the store takes writes.
+     * 
+     * @return true if the log was opened and indexed, false otherwise
+     */
+    bool recover_async();
+
+    /**
+     * @brief Whether a recover_async() replay is still running
+     */
+    bool recovering() const;
+
+    /**
+     * @brief Write a point-in-time image of the store to a file without stopping writers
+     * 
+     * The image is the store as of this call. A dedicated thread scans the index in short
+     * locked slices and streams the records out in large sequential writes; a write that
+     * would change or remove an entry the scan has not saved yet first copies that entry
+     * aside, so only entries changed during the snapshot are ever duplicated. Compressed
+     * values are written as their compressed bytes, after the dictionaries they use, and
+     * a value shared through dedup_values is written once and referred to by id. The
+     * file is written under a temporary name and renamed into place when complete.
+     * Not available under fingerprint_keys, which does not keep the keys.
+     * 
+     * @param path Snapshot file; load it with load_snapshot()
+     * @param max_bytes_per_second Write rate limit (0 = unlimited)
+     * @return std::future<bool> Whether the snapshot was written; false at once if one is
+     *         already running, or with fingerprint_keys or persistent_path set
+     */
+    std::future<bool> snapshot(const std::string& path, size_t max_bytes_per_second = 0);
+
+    /**
+     * @brief Take a snapshot that the WAL can be truncated to
+     * 
+     * Like snapshot(), but the WAL also starts a new segment at the image's point in time.
+     * Once the snapshot is written, the segments before it are recycled; recovery is then
+     * load_snapshot() followed by recover(). A single-file WAL is left as it is.
+     */
+    std::future<bool> checkpoint(const std::string& path, size_t max_bytes_per_second = 0);
+
+    /**
+     * @brief Load a snapshot file written by snapshot()
+     * 
+     * Records are applied like writes but not logged to the WAL; call recover() afterwards
+     * to replay the log on top.
+     * 
+     * @return true if the file was read, false if it could not be opened
+     */
+    bool load_snapshot(const std::string& path);
+
+    /**
+     * @brief Create a named namespace with its own index, budgets, eviction policy and WAL
+     * 
+     * The namespace is a separate KVStore that shares this store's background thread.
+     * It lives until dropped or until this store is destroyed; recover() it separately.
+     * 
+     * @param name The namespace name
+     * @param options Capacity, byte budget, eviction policy and WAL settings for the namespace
+     * @return KVStore* The new namespace, or nullptr if the name is already taken
+     */
+    KVStore* create_namespace(const std::string& name, const StoreOptions& options);
+
+    /**
+     * @brief Look up a namespace by name
+     * 
+     * @param name The namespace name
+     * @return KVStore* The namespace, or nullptr if it does not exist
+     */
+    KVStore* find_namespace(const std::string& name) const;
+
+    /**
+     * @brief Destroy a namespace and all of its entries
+     * 
+     * Callers must no longer use the namespace's KVStore pointer.
+     * 
+     * @param name The namespace name
+     * @return true if the namespace existed and was dropped
+     */
+    bool drop_namespace(const std::string& name);
+
+    /**
+     * @brief List the names of all namespaces
+     * 
+     * @return std::vector<std::string> Namespace names in unspecified order
+     */
+    std::vector<std::string> namespace_names() const;
+
 private:
-    // LRU cache node: stores key in a doubly-linked list
-    using KeyList = std::list<std::string>;
+    /**
+     * @brief Construct a namespace sharing its parent's background worker and arena
+     * 
+     * Either may be null, in which case the namespace creates its own.
+     */
+    KVStore(const StoreOptions& options, std::shared_ptr<BackgroundWorker> background,
+            std::shared_ptr<Arena> arena);
+
+    using Clock = std::chrono::steady_clock;
+
+    // LRU cache node: points at the key stored in the cache_ node rather than copying it
+    using KeyList = std::list<const ArenaBuffer*, ArenaAllocator<const ArenaBuffer*>>;
     using KeyListIterator = KeyList::iterator;
 
-    // Cache entry: stores value and iterator to position in LRU list
+    // GDSF priority queue: lowest priority (next victim) first, keyed to the cache_ key
+    using PriorityQueue = std::multimap<double, const ArenaBuffer*, std::less<double>,
+                                        ArenaAllocator<std::pair<const double, const ArenaBuffer*>>>;
+
+    // Cache entry: stores value, iterator to position in LRU list, expiry and GDSF state.
+    // Keys and values up to ArenaBuffer::kInlineCapacity bytes live inside the hash node,
+    // so for short ones the node's first 64 bytes hold the key, value and LRU link.
     struct CacheEntry {
-        std::string value;
+        ArenaBuffer value;
         KeyListIterator lru_iter;
+        PutOptions options;
+        Clock::time_point written_at;
+        bool refreshing = false;
+        uint32_t frequency = 0;
+        PriorityQueue::iterator priority_iter;
+        bool cold = false;     // Past the cold-tier boundary of lru_list_
+        bool shared = false;   // value borrows its bytes from value_pool_
+        size_t raw_size = 0;   // Decompressed size if value holds LZ4 data, else 0
+        uint32_t dict_version = 0; // Dictionary the value was compressed against (0 = none)
+        uint64_t snapshot_epoch = 0; // Epoch of its last write, or of the snapshot that saved it
+
+        bool has_ttl() const {
+            return options.soft_ttl.count() > 0 || options.hard_ttl.count() > 0;
+        }
+        bool is_stale(Clock::time_point now) const {
+            return options.soft_ttl.count() > 0 && now >= written_at + options.soft_ttl;
+        }
+        bool is_expired(Clock::time_point now) const {
+            return options.hard_ttl.count() > 0 && now >= written_at + options.hard_ttl;
+        }
     };
 
+    using CacheMap = std::unordered_map<ArenaBuffer, CacheEntry, ArenaBufferHash, std::equal_to<ArenaBuffer>,
+                                        ArenaAllocator<std::pair<const ArenaBuffer, CacheEntry>>>;
+
+    // Dedup pool: each distinct shared value and the number of entries referencing it
+    using ValuePool = std::unordered_map<ArenaBuffer, size_t, ArenaBufferHash, std::equal_to<ArenaBuffer>,
+                                         ArenaAllocator<std::pair<const ArenaBuffer, size_t>>>;
+
+    // Arena holding index nodes and values; declared first so it outlives them
+    std::shared_ptr<Arena> arena_;
+
     // Hash map for O(1) lookups
-    std::unordered_map<std::string, CacheEntry> cache_;
+    CacheMap cache_;
     
     // LRU list: most recently used at front, least recently used at back
     KeyList lru_list_;
     
+    // GDSF queue, only maintained under EvictionPolicy::GDSF
+    PriorityQueue priority_queue_;
+    
+    // Entry storage detached by clear() or the destructor, awaiting teardown
+    struct DetachedTables {
+        explicit DetachedTables(std::shared_ptr<Arena> arena_ref)
+            : arena(std::move(arena_ref)),
+              cache(0, ArenaBufferHash(), std::equal_to<ArenaBuffer>(), CacheMap::allocator_type(arena.get())),
+              lru_list(KeyList::allocator_type(arena.get())),
+              priority_queue(PriorityQueue::allocator_type(arena.get())),
+              value_pool(0, ArenaBufferHash(), std::equal_to<ArenaBuffer>(), ValuePool::allocator_type(arena.get())) {}
+
+        std::shared_ptr<Arena> arena; // Keeps the arena alive until the entries are gone
+        CacheMap cache;
+        KeyList lru_list;
+        PriorityQueue priority_queue;
+        ValuePool value_pool;
+        std::vector<ArenaBuffer> pending_frees;
+    };
+    
+    // GDSF inflation clock: priority of the last evicted entry
+    double gdsf_clock_ = 0.0;
+    
     // Maximum capacity before eviction
     size_t max_capacity_;
     
+    // Byte budget (0 = unbounded) and current approximate footprint
+    size_t max_bytes_ = 0;
+    size_t bytes_used_ = 0;
+    
+    EvictionPolicy eviction_policy_ = EvictionPolicy::LRU;
+    
+    // Operation counters and heavy-hitter sketch reported by stats()
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+    HotKeyTracker hot_keys_;
+    
+    // Per-core replicas of the hottest keys (null unless hot_key_replication is set)
+    std::unique_ptr<HotKeyReplicas> replicas_;
+    size_t replicated_hot_keys_ = 0;
+    uint64_t ops_since_replica_refresh_ = 0;
+    std::atomic<uint64_t> replica_hits_{0};
+    std::unordered_map<std::string, std::string> replica_sources_; // Replica key -> key the tracker counts
+    
+    // Filter over the index keys (null unless key_filter is set); read without mutex_
+    std::unique_ptr<KeyFilter> key_filter_;
+    mutable std::atomic<uint64_t> filtered_misses_{0};
+    
+    // Shared-memory mirror of the entries for other processes (null unless shared_memory_name is set)
+    std::unique_ptr<MappedTable> shared_table_;
+    
+    // Durable mapped copy of the entries (null unless persistent_path is set)
+    std::unique_ptr<MappedTable> persistent_table_;
+    uint64_t persistent_faults_ = 0;
+    uint64_t persistent_write_failures_ = 0;
+    
+    // Pooled values a snapshot has written in SHARED records, by address, with their ids
+    struct SharedValueIds {
+        std::unordered_map<const char*, uint64_t> ids;
+        uint64_t next = 1;
+    };
+    
+    // Copy-on-write snapshot in progress (null when none); entries whose snapshot_epoch is
+    // below its epoch belong to the image and have not been saved yet
+    struct SnapshotState {
+        uint64_t epoch;
+        size_t cursor = 0;       // Next cache_ bucket to scan
+        size_t bucket_count = 0; // cache_ bucket count the cursor refers to
+        std::string copied;      // Records of unsaved entries changed since, not yet streamed
+        std::vector<std::shared_ptr<DetachedTables>> detached; // Cleared tables left to save
+        SharedValueIds shared;
+    };
+    std::unique_ptr<SnapshotState> snapshot_;
+    uint64_t snapshot_epoch_ = 0;
+    uint64_t snapshot_cow_copies_ = 0;
+    std::thread snapshot_thread_;
+    std::mutex snapshot_thread_mutex_; // Guards starting and joining snapshot_thread_
+    std::atomic<bool> snapshotting_{false};
+    std::atomic<bool> snapshot_cancelled_{false};
+    
+    // Background reclaimer settings and state
+    bool background_eviction_ = false;
+    double high_watermark_ = 0.9;
+    double low_watermark_ = 0.8;
+    bool reclaim_scheduled_ = false;
+    
+    // Active defrag settings and state; the cursor is the next cache_ bucket to scan
+    bool active_defrag_ = false;
+    double defrag_threshold_ = 1.3;
+    std::chrono::microseconds defrag_slice_{1000};
+    bool defrag_scheduled_ = false;
+    size_t defrag_cursor_ = 0;
+    uint64_t writes_since_defrag_check_ = 0;
+    uint64_t defrag_check_interval_ = 0;
+    uint64_t defrag_moves_ = 0;
+    
+    // Cold tier: every lru_list_ entry from cold_boundary_ to the back is cold
+    bool compress_cold_ = false;
+    double cold_fraction_ = 0.5;
+    KeyListIterator cold_boundary_;
+    size_t cold_entries_ = 0;
+    size_t cold_bytes_saved_ = 0;
+    std::string compress_scratch_;
+    
+    // Value compression and trained dictionaries by version, with the number of entries
+    // compressed against each; older versions are dropped once unused
+    struct DictionarySlot {
+        std::shared_ptr<const lz4::Dictionary> dictionary;
+        size_t entries = 0;
+    };
+    bool compress_values_ = false;
+    std::map<uint32_t, DictionarySlot> dictionaries_;
+    uint32_t dictionary_version_ = 0;
+    size_t compressed_bytes_saved_ = 0;
+    
+    // Index key length under fingerprint_keys (0 = full keys): a 64-bit fingerprint,
+    // optionally followed by a 32-bit checksum
+    static constexpr size_t kMaxFingerprintSize = 12;
+    size_t fingerprint_size_ = 0;
+    
+    // Value dedup pool (only used with dedup_values)
+    bool dedup_values_ = false;
+    ValuePool value_pool_;
+    size_t dedup_bytes_saved_ = 0;
+    
+    // Large values waiting to be freed off the request path
+    size_t lazy_free_threshold_ = 0;
+    std::vector<ArenaBuffer> pending_frees_;
+    bool free_scheduled_ = false;
+    
     // Thread safety
     mutable std::mutex mutex_;
+
+    // In-flight loads for get_or_load(), keyed by the missing key
+    std::unordered_map<std::string, std::shared_future<std::optional<std::string>>> inflight_loads_;
+    
+    // Backend fetch for stale-while-revalidate refreshes
+    Loader refresher_;
+    
+    // Negative cache: keys a loader confirmed absent, kept apart from cache_. Only a 64-bit
+    // hash of each key is stored, so an entry costs the same whatever the key's length
+    struct NegativeEntry {
+        Clock::time_point expires_at;
+        std::list<uint64_t>::iterator order_iter;
+    };
+    std::unordered_map<uint64_t, NegativeEntry> negative_cache_;
+    std::list<uint64_t> negative_order_; // Key hashes, newest at front, oldest at back
+    size_t negative_capacity_ = 0;
+    std::chrono::milliseconds negative_ttl_{0};
     
     // Write-ahead log
     std::string wal_path_;
-    std::unique_ptr<std::ofstream> wal_file_;
+    std::unique_ptr<WalWriter> wal_file_;
+    bool wal_prepare_scheduled_ = false;
+    bool wal_failure_reported_ = false;
+    
+    // Progressive recovery (recover_async): the last unreplayed record of each key, by
+    // log offset, and the replay position; recovering_ is also read without mutex_
+    struct PendingRecord {
+        uint64_t offset;
+        bool deleted;
+    };
+    std::atomic<bool> recovering_{false};
+    std::unordered_map<std::string, PendingRecord> recovery_pending_;
+    // Dictionaries by version, then by the log offset of their DICT record
+    std::unordered_map<uint32_t, std::map<uint64_t, std::shared_ptr<const lz4::Dictionary>>> recovery_dictionaries_;
+    // Offsets run on across the log's files (segments); recovery_reader_ has one of them open
+    std::vector<std::pair<uint64_t, std::string>> recovery_files_; // Start offset and path
+    std::unique_ptr<WalReader> recovery_reader_;
+    size_t recovery_file_ = 0;
+    uint64_t recovery_offset_ = 0;
+    uint64_t recovery_end_ = 0;
+    WalDurability wal_durability_ = WalDurability::Flush;
+    
+    // Namespaces owned by this store
+    mutable std::mutex namespaces_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<KVStore>> namespaces_;
+    
+    // Tasks this store has queued on the (possibly shared) background worker
+    size_t background_tasks_ = 0;
+    std::condition_variable background_idle_;
+    
+    // NUMA node of the arena and background worker (-1 = unbound)
+    int numa_node_ = -1;
+    
+    // Runs refreshes, reclaims and frees off the request path; shared with namespaces
+    std::shared_ptr<BackgroundWorker> background_;
+    
+    /**
+     * @brief Insert or update a key-value pair (mutex_ must be held)
+     * 
+     * @param durable Also write the WAL and the persistent file (false when the value
+     *        came from one of them)
+     * @return false if the persistent file could not take the entry
+     */
+    bool put_locked(const std::string& key, const std::string& value, const PutOptions& options,
+                    bool durable = true);
+    
+    /**
+     * @brief Load a key missing from memory from the persistent file (mutex_ must be held)
+     * 
+     * @return CacheMap::iterator The loaded entry, or cache_.end() if the file lacks it too
+     */
+    CacheMap::iterator fault_in(const std::string& key);
+    
+    /**
+     * @brief Apply a key's unreplayed WAL record, if it has one, before the key is used (mutex_ must be held)
+     */
+    void replay_pending(const std::string& key);
+    
+    /**
+     * @brief Apply one PUT, PUTZ or DEL log line, read at log offset @p offset, and mark its
+     *        key replayed (mutex_ must be held)
+     */
+    void apply_record(const std::string& line, uint64_t offset);
+    
+    /**
+     * @brief Replay the indexed log in slices (runs on the background thread)
+     */
+    void replay_log();
+    
+    /**
+     * @brief Read the log record at a recovery offset (mutex_ must be held)
+     * 
+     * @param next Set to the offset of the record after it
+     * @return false past the end of the log's last file
+     */
+    bool read_recovery_record(uint64_t offset, std::string& line, uint64_t& next);
+    
+    /**
+     * @brief Apply the records of log or snapshot files, in order, without logging them
+     */
+    bool replay(const std::vector<std::string>& paths);
+    
+    /**
+     * @brief Start snapshot() or, rolling the WAL to a new segment first, checkpoint()
+     */
+    std::future<bool> start_snapshot(const std::string& path, size_t max_bytes_per_second, bool checkpoint);
+    
+    /**
+     * @brief Encode an entry as a PUT or, if compressed, a PUTZ record line
+     * 
+     * An entry sharing a pooled value becomes a PUTS line referring to the value by id,
+     * preceded by a SHARED line with the value itself the first time it is written.
+     */
+    std::string snapshot_record(const ArenaBuffer& key, const CacheEntry& entry, SharedValueIds& shared) const;
+    
+    /**
+     * @brief Copy an entry aside if the running snapshot has not saved it yet (mutex_ must be held)
+     */
+    void preserve_for_snapshot(CacheEntry& entry, const ArenaBuffer& key);
+    
+    /**
+     * @brief Hand cleared tables to the running snapshot if there is one (mutex_ must be held)
+     * 
+     * @return true if the snapshot took them
+     */
+    bool keep_for_snapshot(std::shared_ptr<DetachedTables>& tables);
+    
+    /**
+     * @brief Scan and stream a snapshot to @p path (runs on snapshot_thread_)
+     */
+    bool stream_snapshot(const std::string& path, size_t max_bytes_per_second);
     
     /**
-     * @brief Touch a key to mark it as recently used (move to front of LRU list)
+     * @brief Look up a live entry, erasing it if past its hard TTL (mutex_ must be held)
      * 
-     * @param key The key to touch
+     * @param key The key to look up
+     * @return CacheMap::iterator The entry, or cache_.end() if absent or expired
      */
-    void touch(const std::string& key);
+    CacheMap::iterator find_live(const std::string& key);
     
     /**
-     * @brief Evict the least recently used entry
+     * @brief Find a key's entry without copying the key (mutex_ must be held)
      */
-    void evict_lru();
+    CacheMap::iterator lookup(const std::string& key) {
+        char fingerprint[kMaxFingerprintSize];
+        return cache_.find(index_key(key, fingerprint));
+    }
+    CacheMap::const_iterator lookup(const std::string& key) const {
+        char fingerprint[kMaxFingerprintSize];
+        return cache_.find(index_key(key, fingerprint));
+    }
+    
+    /**
+     * @brief The form a key takes in the index: the key itself, or its fingerprint
+     * 
+     * @param scratch Space for the fingerprint, which the returned buffer borrows
+     */
+    ArenaBuffer index_key(const std::string& key, char* scratch) const {
+        if (fingerprint_size_ == 0) {
+            return ArenaBuffer::borrow(key.data(), key.size());
+        }
+        fingerprint(key, scratch);
+        return ArenaBuffer::borrow(scratch, fingerprint_size_);
+    }
+    
+    /**
+     * @brief Write a key's fingerprint_size_-byte fingerprint to @p out
+     */
+    void fingerprint(const std::string& key, char* out) const;
+    
+    /**
+     * @brief Hash of an index key for key_filter_
+     */
+    static uint64_t filter_hash(const ArenaBuffer& index);
+    
+    /**
+     * @brief Whether the key filter rules a key out (safe without mutex_)
+     */
+    bool filtered_out(const std::string& key) const;
+    
+    /**
+     * @brief Key the hot-key replicas use for @p key (its index key)
+     */
+    std::string replica_key(const std::string& key) const;
+    
+    /**
+     * @brief Count a write the persistent file refused, warning on the first (mutex_ must be held)
+     */
+    void persistent_write_failed(const std::string& key, const std::string& value);
+    
+    /**
+     * @brief Check whether a key is negatively cached, dropping it if expired (mutex_ must be held)
+     */
+    bool is_known_absent(const std::string& key);
+    
+    /**
+     * @brief Remember a key as absent, evicting the oldest negative entry if full (mutex_ must be held)
+     */
+    void remember_absent(const std::string& key);
+    
+    /**
+     * @brief Forget a negatively cached key (mutex_ must be held)
+     */
+    void forget_absent(const std::string& key);
+    
+    /**
+     * @brief Touch an entry to mark it as recently used (move to front of LRU list)
+     * 
+     * @param it The entry to touch
+     */
+    void touch(CacheMap::iterator it);
+    
+    /**
+     * @brief Schedule a background refresh if the entry is stale (mutex_ must be held)
+     * 
+     * @param it The entry that was just read
+     * @param key The entry's key (the index may only hold its fingerprint)
+     */
+    void maybe_refresh(CacheMap::iterator it, const std::string& key);
+    
+    /**
+     * @brief Reload a stale key through the refresher (runs on the background thread)
+     * 
+     * @param key The key to refresh
+     */
+    void refresh(const std::string& key);
+    
+    /**
+     * @brief Read a hot key from the calling core's replica, without mutex_
+     */
+    std::optional<std::string> get_replica(const std::string& key);
+    
+    /**
+     * @brief Re-pick the replicated keys from the hot-key tracker (mutex_ must be held)
+     * 
+     * Replica hits since the last pick are counted in the tracker first, and the tracker's
+     * counts are halved afterwards, so replicas follow the keys that are hot now.
+     */
+    void refresh_replicas();
+    
+    /**
+     * @brief Approximate footprint of one entry, as charged against the byte budget
+     */
+    static size_t entry_bytes(size_t key_size, size_t value_size);
+    
+    /**
+     * @brief Value bytes charged to an entry itself (0 for a shared value, charged to the pool)
+     */
+    static size_t stored_size(const CacheEntry& entry);
+    
+    /**
+     * @brief Recompute an entry's GDSF priority and reposition it in the queue (mutex_ must be held)
+     */
+    void update_priority(CacheMap::iterator it);
+    
+    /**
+     * @brief Remove an entry from the index and all eviction bookkeeping (mutex_ must be held)
+     */
+    void erase_entry(CacheMap::iterator it);
+    
+    /**
+     * @brief Check whether the entry count or byte budget is exceeded (mutex_ must be held)
+     */
+    bool over_budget() const;
+    
+    /**
+     * @brief Evict one entry chosen by the eviction policy (mutex_ must be held)
+     * 
+     * @param protect Key that must not be chosen (the entry being written), or nullptr
+     * @return true if an entry was evicted, false if no candidate was left
+     */
+    bool evict(const ArenaBuffer* protect);
+    
+    /**
+     * @brief Check whether usage exceeds a fraction of the entry or byte budget (mutex_ must be held)
+     */
+    bool above_watermark(double fraction) const;
+    
+    /**
+     * @brief Evict down to the low watermark in small batches (runs on the background thread)
+     */
+    void reclaim();
+    
+    /**
+     * @brief Take an entry out of the cold tier without touching its value (mutex_ must be held)
+     */
+    void leave_cold_tier(CacheMap::iterator it);
+    
+    /**
+     * @brief Decompress a cold entry and take it out of the cold tier (mutex_ must be held)
+     */
+    void promote(CacheMap::iterator it);
+    
+    /**
+     * @brief Compress entries crossing into the cold fraction of lru_list_ (mutex_ must be held)
+     */
+    void compress_cold();
+    
+    /**
+     * @brief Store a value in an entry, compressed if compress_values is set (mutex_ must be held)
+     * 
+     * The entry's previous value must already have been released.
+     */
+    void set_value(CacheEntry& entry, const char* data, size_t size);
+    
+    /**
+     * @brief Compress a value into an entry against the current dictionary (mutex_ must be held)
+     * 
+     * @return true if it compressed well enough to store; the entry is untouched otherwise
+     */
+    bool compress_into(CacheEntry& entry, const char* data, size_t size);
+    
+    /**
+     * @brief Point an entry at the pooled copy of a value, adding one if needed (mutex_ must be held)
+     * 
+     * @p data may be the entry's own value, whose storage is then moved into the pool.
+     */
+    void share_value(CacheEntry& entry, const char* data, size_t size);
+    
+    /**
+     * @brief Free an entry's value and drop its dictionary reference (mutex_ must be held)
+     */
+    void release_value(CacheEntry& entry);
+    
+    /**
+     * @brief Copy an entry's value out, decompressing it if needed (mutex_ must be held)
+     */
+    std::string value_of(const CacheEntry& entry) const;
+    
+    /**
+     * @brief Make a dictionary the current version (mutex_ must be held)
+     */
+    void install_dictionary(uint32_t version, std::string content);
+    
+    /**
+     * @brief Have each new WAL segment start with the live dictionaries, so its compressed
+     *        records still decode once a checkpoint recycles the segments before it (mutex_ must be held)
+     */
+    void relog_dictionaries();
+    
+    /**
+     * @brief Free compress_scratch_ if a large value grew it (mutex_ must be held)
+     */
+    void release_scratch();
+    
+    /**
+     * @brief Count a write and schedule a defrag pass if the arena is fragmented (mutex_ must be held)
+     */
+    void maybe_defrag();
+    
+    /**
+     * @brief Move values off sparse arena pages in time slices (runs on the background thread)
+     */
+    void defrag();
+    
+    /**
+     * @brief Move the values and index nodes of one cache_ bucket off sparse pages (mutex_ must be held)
+     * 
+     * @return uint64_t Allocations moved
+     */
+    uint64_t defrag_bucket(size_t bucket);
+    
+    /**
+     * @brief Release a value that is no longer referenced (mutex_ must be held)
+     * 
+     * Large values are queued and freed on the background thread instead of inline.
+     */
+    void dispose(ArenaBuffer&& value);
+    
+    /**
+     * @brief Swap all entry storage out into @p tables, leaving the store empty (mutex_ must be held)
+     */
+    void detach_tables(DetachedTables& tables);
+    
+    /**
+     * @brief Get the background worker, starting it on first use (mutex_ must be held)
+     */
+    BackgroundWorker& background();
+    
+    /**
+     * @brief Queue a task that uses this store, tracked so destruction waits for it (mutex_ must be held)
+     */
+    void submit_background(std::function<void()> task);
     
     /**
      * @brief Write an operation to the write-ahead log
@@ -134,6 +1088,14 @@ private:
      * @param value The value (empty for DEL and CLEAR)
      */
     void write_wal(const std::string& operation, const std::string& key, const std::string& value = "");
+
+    /**
+     * @brief Wait until the records written to the log so far are flushed or synced, per the
+     *        durability; called after releasing mutex_ so concurrent writers commit together
+     *
+     * @param wal wal_file_ as read under mutex_ (may be null)
+     */
+    static void commit_wal(WalWriter* wal);
 };
 
 } // namespace kvstore
@@ -0,0 +1,81 @@
+#ifndef LZ4_HPP
+#define LZ4_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kvstore {
+namespace lz4 {
+
+/**
+ * @brief Shared history that small, similar inputs are compressed against
+ *
+ * Matches may reach back into the dictionary as if it preceded every input, so a value
+ * whose structure is already in the dictionary compresses well even when it is too
+ * short to repeat itself. Only the last 64 KB of the content is usable. Immutable once
+ * built, so one instance can be shared by concurrent compressions.
+ */
+class Dictionary {
+public:
+    explicit Dictionary(std::string content);
+
+    const std::string& content() const {
+        return content_;
+    }
+
+private:
+    friend size_t compress(const char* src, size_t size, char* dst, size_t capacity,
+                           const Dictionary* dictionary);
+
+    std::string content_;
+    std::vector<uint32_t> table_; // 4-byte hash -> content position + 1 (0 = none)
+};
+
+/**
+ * @brief Build a dictionary of at most @p max_size bytes from sample inputs
+ *
+ * Splits the concatenated samples into epochs and keeps the segment of each epoch whose
+ * 8-byte substrings are most frequent across all samples, discounting substrings already
+ * covered (a simplified form of zstd's COVER trainer).
+ */
+std::string train_dictionary(const std::vector<std::string>& samples, size_t max_size);
+
+/**
+ * @brief Largest compressed size of @p size input bytes
+ */
+inline size_t compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+/**
+ * @brief Compress a buffer into the LZ4 block format
+ *
+ * Greedy single-pass matcher with a 4K-entry hash table: roughly LZ4's default speed
+ * level, fast enough to run on the request path. Inputs over 4 GB are not supported.
+ *
+ * @param dst Output buffer of at least compress_bound(size) bytes
+ * @param dictionary History to match against; decompression needs the same one
+ * @return size_t Compressed size, or 0 if @p capacity is below compress_bound(size)
+ */
+size_t compress(const char* src, size_t size, char* dst, size_t capacity,
+                const Dictionary* dictionary = nullptr);
+
+/**
+ * @brief Decompress an LZ4 block whose decompressed size is known
+ *
+ * Every length and offset is bounds-checked, so corrupt input fails rather than
+ * reading or writing out of range.
+ *
+ * @param dst Output buffer of exactly @p original_size bytes
+ * @param dictionary The dictionary the block was compressed with, if any
+ * @return true if the block decoded to exactly @p original_size bytes
+ */
+bool decompress(const char* src, size_t size, char* dst, size_t original_size,
+                const Dictionary* dictionary = nullptr);
+
+} // namespace lz4
+} // namespace kvstore
+
+#endif // LZ4_HPP
@@ -0,0 +1,188 @@
+#ifndef MAPPED_TABLE_HPP
+#define MAPPED_TABLE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace kvstore {
+
+/**
+ * @brief Fixed-size open-addressing hash table in a shared-memory region or mapped file.
+ *
+ * One writer publishes entries. In a POSIX shared-memory table, any number of reader
+ * processes map the same region and look keys up with no lock, IPC or system call.
+ * Every slot carries a sequence counter (a seqlock). The writer makes it odd while it
+ * rewrites the slot and even again when done. A reader retries any slot whose counter
+ * was odd or changed while it was copied out.
+ *
+ * A file-backed table survives restarts and reopens in O(1). An update writes the new
+ * record to a free slot (and msyncs it) before it retires the old one; a slot is never
+ * rewritten in place, so an update with no free slot in its probe window is refused.
+ * Each record also carries a checksum. So after a crash a key has either its old or its
+ * new value; a torn slot is skipped, never returned.
+ *
+ * Slots are slot_size bytes, including a 40-byte header, and hold the key and value
+ * inline. Entries that do not fit are not stored. Collisions probe linearly for at most
+ * 64 slots. Deletes leave tombstones, which are cleared once nothing probes past them.
+ * clear() is O(1): it bumps a generation number in the header, and slots written in an
+ * earlier generation read as empty and are overwritten as they are reused.
+ */
+class MappedTable {
+public:
+    /**
+     * @brief Create (or replace) a shared-memory table as its writer
+     *
+     * @param name POSIX shared-memory object name, e.g. "/kvstore"
+     * @param slots Number of slots (rounded up to a power of two)
+     * @param slot_size Bytes per slot (rounded up to a multiple of 64)
+     * @return std::unique_ptr<MappedTable> The table, or nullptr if the region could not be created
+     */
+    static std::unique_ptr<MappedTable> create_shared(const std::string& name, size_t slots, size_t slot_size);
+
+    /**
+     * @brief Map an existing shared-memory table read-only
+     *
+     * @return std::unique_ptr<MappedTable> The table, or nullptr if absent or not a table
+     */
+    static std::unique_ptr<MappedTable> open_shared(const std::string& name);
+
+    /**
+     * @brief Open a file-backed table as its writer, creating it if absent
+     *
+     * Reopening only maps the file and checks its header; no entry is read. The file is
+     * locked against a second writer.
+     *
+     * @param slots Number of slots for a new file (an existing one keeps its geometry)
+     * @param slot_size Bytes per slot for a new file
+     * @param sync msync every update before it returns
+     * @return std::unique_ptr<MappedTable> The table, or nullptr if the file could not be
+     *         opened, is locked, or is not a table
+     */
+    static std::unique_ptr<MappedTable> open_file(const std::string& path, size_t slots, size_t slot_size,
+                                                  bool sync);
+
+    /**
+     * @brief Unmap the region; a shared-memory writer also marks it closed and removes its name
+     */
+    ~MappedTable();
+
+    MappedTable(const MappedTable&) = delete;
+    MappedTable& operator=(const MappedTable&) = delete;
+
+    /**
+     * @brief Look up a key without locking (safe from any thread or process)
+     *
+     * @param ttl If set, receives the entry's remaining time to live (zero if it has none)
+     * @return std::optional<std::string> The value, or std::nullopt if absent or expired
+     */
+    std::optional<std::string> get(std::string_view key, std::chrono::nanoseconds* ttl = nullptr) const;
+
+    /**
+     * @brief Insert or replace an entry (writer only)
+     *
+     * @param ttl Time to live (zero = never expires)
+     * @return true if stored; false if it does not fit a slot or its probe window is full
+     *         (any older entry for the key is removed)
+     */
+    bool put(std::string_view key, std::string_view value, std::chrono::nanoseconds ttl = {});
+
+    /**
+     * @brief Remove an entry if present (writer only)
+     *
+     * @return true if the key was present
+     */
+    bool erase(std::string_view key);
+
+    /**
+     * @brief Remove every entry in O(1) by starting a new generation (writer only)
+     */
+    void clear();
+
+    /**
+     * @brief Number of stored entries (approximate after a crash)
+     */
+    size_t size() const;
+
+    /**
+     * @brief Largest key plus value size a slot holds (the slot size less its 40-byte header)
+     */
+    size_t max_record_size() const;
+
+    /**
+     * @brief Whether the writer has closed the table (readers should reopen it)
+     */
+    bool closed() const;
+
+private:
+    struct Header;
+    struct Slot;
+
+    MappedTable(void* base, size_t length, bool writer, std::string name, int fd, bool sync);
+
+    /**
+     * @brief Map a region and check that its header describes a table of that length
+     */
+    static void* map_table(int fd, size_t length, bool writable);
+
+    Slot* slot_at(size_t index) const;
+
+    /**
+     * @brief Now on the table's clock: steady for shared memory, wall time for files
+     */
+    int64_t now() const;
+
+    /**
+     * @brief A slot's SlotState in table generation @p generation (kEmpty if written in an earlier one)
+     */
+    static uint32_t state_of(const Slot* slot, uint64_t generation);
+
+    /**
+     * @brief Whether a slot's record is complete (a crash may have torn it)
+     */
+    bool intact(const Slot* slot, uint64_t generation) const;
+
+    /**
+     * @brief Find a live slot holding a key (writer only)
+     *
+     * @param free Set to the first reusable slot in the probe chain, or nullptr
+     * @param skip A slot to pass over
+     * @return Slot* The first such slot, or nullptr if none
+     */
+    Slot* find(std::string_view key, uint64_t hash, Slot** free, const Slot* skip = nullptr) const;
+
+    /**
+     * @brief Rewrite a slot under its seqlock (writer only)
+     */
+    void write_slot(Slot* slot, uint32_t state, uint64_t hash, std::string_view key,
+                    std::string_view value, int64_t expires_at);
+
+    /**
+     * @brief Tombstone a slot, then empty it and any tombstones before it that end a chain
+     */
+    void remove_slot(Slot* slot);
+
+    /**
+     * @brief msync a slot's bytes if the table syncs every update
+     */
+    void sync(const Slot* slot) const;
+
+    Header* header_;
+    char* slots_;
+    size_t length_;
+    size_t mask_;
+    size_t slot_size_;
+    bool writer_;
+    std::string name_; // Shared-memory name (empty for a file)
+    int fd_;           // Open, locked file (-1 for shared memory)
+    bool sync_;
+};
+
+} // namespace kvstore
+
+#endif // MAPPED_TABLE_HPP
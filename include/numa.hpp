@@ -0,0 +1,41 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace kvstore {
+namespace numa {
+
+/**
+ * @brief CPUs belonging to a NUMA node
+ * 
+ * @param node The node to query
+ * @return std::vector<int> CPU ids, empty if the node does not exist
+ */
+std::vector<int> node_cpus(int node);
+
+/**
+ * @brief Restrict the calling thread to the CPUs of a NUMA node
+ * 
+ * @param node The node to pin to
+ * @return true if the affinity was applied
+ */
+bool pin_current_thread(int node);
+
+/**
+ * @brief Bind a page-aligned memory range to a NUMA node (mbind with MPOL_BIND)
+ * 
+ * Must be called before the pages are first touched for the placement to apply.
+ * 
+ * @param addr Start of the range, page aligned
+ * @param length Length of the range in bytes
+ * @param node The node whose memory backs the range
+ * @return true if the policy was applied
+ */
+bool bind_memory(void* addr, size_t length, int node);
+
+} // namespace numa
+} // namespace kvstore
+
+#endif // NUMA_HPP
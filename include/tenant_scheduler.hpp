@@ -0,0 +1,155 @@
+#ifndef TENANT_SCHEDULER_HPP
+#define TENANT_SCHEDULER_HPP
+
+#include "kv_store.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace kvstore {
+
+/**
+ * @brief Per-tenant limits enforced by TenantScheduler
+ */
+struct TenantQuota {
+    // Share of worker time relative to other tenants with queued requests
+    uint32_t weight = 1;
+
+    // Token-bucket request rate (0 = unlimited) and bucket size (0 = one second's worth)
+    double max_ops_per_second = 0.0;
+    double burst = 0.0;
+
+    // Memory quota: byte budget of the tenant's namespace (0 = unbounded)
+    size_t max_bytes = 0;
+
+    // Maximum number of queued requests before submissions are rejected
+    size_t max_queue_depth = 1024;
+};
+
+/**
+ * @brief Outcome of TenantScheduler::submit()
+ */
+enum class SubmitStatus {
+    Accepted,
+    RateLimited,   // The tenant's token bucket is empty
+    QueueFull,     // The tenant already has max_queue_depth requests queued
+    UnknownTenant
+};
+
+/**
+ * @brief Runs client requests against per-tenant namespaces with quotas and fair sharing.
+ *
+ * Each tenant gets its own namespace in the underlying KVStore, sized by its memory
+ * quota, so one tenant's writes only ever evict its own keys. Submissions are admitted
+ * through a per-tenant token bucket and queued per tenant; worker threads then serve the
+ * queues with deficit round robin, so every backlogged tenant receives service in
+ * proportion to its weight and a bulk loader cannot starve latency-sensitive readers.
+ */
+class TenantScheduler {
+public:
+    /**
+     * @brief A request, run on a worker thread against the tenant's namespace
+     */
+    using Request = std::function<void(KVStore& keyspace)>;
+
+    /**
+     * @brief Construct a scheduler over a store
+     * 
+     * @param store The store in which tenant namespaces are created; must outlive the scheduler
+     * @param num_workers Number of worker threads serving the tenant queues
+     * @param numa_node NUMA node whose CPUs the workers are pinned to (-1 = no pinning); match
+     *        the node the tenants' namespaces are bound to so requests run next to their memory
+     */
+    explicit TenantScheduler(KVStore& store, size_t num_workers = 1, int numa_node = -1);
+
+    /**
+     * @brief Run all queued requests, then stop and join the workers
+     */
+    ~TenantScheduler();
+
+    TenantScheduler(const TenantScheduler&) = delete;
+    TenantScheduler& operator=(const TenantScheduler&) = delete;
+
+    /**
+     * @brief Register a tenant and create its namespace
+     * 
+     * @param tenant The tenant name, also used as its namespace name
+     * @param quota Weight, rate and memory limits for the tenant
+     * @param options Namespace settings; max_bytes is overridden by quota.max_bytes when set
+     * @return true if the tenant was added, false if the name is already in use
+     */
+    bool add_tenant(const std::string& tenant, const TenantQuota& quota,
+                    const StoreOptions& options = StoreOptions());
+
+    /**
+     * @brief Queue a request for a tenant
+     * 
+     * @param tenant The tenant issuing the request
+     * @param request The work to run against the tenant's namespace
+     * @return SubmitStatus Accepted, or why the request was rejected
+     */
+    SubmitStatus submit(const std::string& tenant, Request request);
+
+    /**
+     * @brief Block until every queued request has run
+     */
+    void drain();
+
+private:
+    struct Tenant {
+        TenantQuota quota;
+        KVStore* keyspace = nullptr;
+        std::deque<Request> queue;
+
+        // Token bucket state
+        double tokens = 0.0;
+        std::chrono::steady_clock::time_point last_refill;
+
+        // Requests this tenant may still run in its current round-robin turn
+        uint32_t deficit = 0;
+    };
+
+    KVStore& store_;
+    int numa_node_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::unordered_map<std::string, std::unique_ptr<Tenant>> tenants_;
+
+    // Round-robin ring of tenants and the tenant whose turn it is
+    std::vector<Tenant*> ring_;
+    size_t cursor_ = 0;
+
+    size_t queued_ = 0;
+    size_t running_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    /**
+     * @brief Refill a tenant's bucket and take one token if available (mutex_ must be held)
+     */
+    static bool take_token(Tenant& tenant);
+
+    /**
+     * @brief Pick the next request by deficit round robin (mutex_ must be held, queued_ > 0)
+     */
+    std::pair<Tenant*, Request> next_request();
+
+    /**
+     * @brief Worker thread body
+     */
+    void run();
+};
+
+} // namespace kvstore
+
+#endif // TENANT_SCHEDULER_HPP
@@ -0,0 +1,338 @@
+#ifndef WAL_WRITER_HPP
+#define WAL_WRITER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace kvstore {
+
+/**
+ * @brief How eagerly WAL records are pushed to the operating system
+ */
+enum class WalDurability {
+    Buffered, // Records are buffered in-process and written in batches
+    Flush,    // Every record is written to the OS before the operation returns
+    Sync      // Every record is also fdatasync'ed to the device before the operation returns
+};
+
+/**
+ * @brief Append-only writer for the write-ahead log, as one file or as fixed-size segments.
+ *
+ * In segmented mode the log is a numbered series of files, "<path>.000001" and up. Each
+ * segment is preallocated to its full size with fallocate, so appends write into blocks
+ * the file already owns and never change its size; a record that does not fit starts the
+ * next segment. Spare segments are prepared ahead of need by prepare_segments(), off the
+ * write path. After a checkpoint the segments it covers are recycled: zeroed and renamed
+ * to the end of the series, so their blocks are reused rather than freed and reallocated.
+ * Every segment starts with the owner's segment header records (see set_segment_header()),
+ * so the records in it still replay once the segments before it are gone.
+ *
+ * The unwritten tail of a segment reads as zero bytes. Readers stop a file at the first
+ * zero byte, which also drops a record torn by a crash.
+ *
+ * In direct mode the log bypasses the page cache (O_DIRECT) and is written in 4 KB
+ * blocks from two 4 KB-aligned 64 KB buffers: one fills while the writer's I/O thread
+ * writes the other. Each block is framed with a checksum, its payload length and the
+ * offset of the first record starting in it, and zero-padded. Records are packed: a
+ * flush writes the partial last block as it stands and later records continue in it.
+ * Successive images of a partial block alternate between its own place and the block
+ * after it (marked as a shadow), so the image written before stays intact while the
+ * next one is written; WalReader takes the longer of the two. The last block of each
+ * segment is kept for that shadow. Flushes and syncs are group commits: the I/O thread
+ * writes every record appended so far in one go, and commit() waits for it outside the
+ * owner's lock. WalReader skips a block that fails its checksum (torn by a crash) and
+ * resumes at the next block's first record. Records never span segments.
+ *
+ * append(), flush() and roll() must be serialized by the owner; commit(),
+ * prepare_segments() and recycle() may run concurrently with them on another thread.
+ */
+class WalWriter {
+public:
+    /**
+     * @brief Open a log for appending, creating it if absent
+     *
+     * A segmented log continues in the segment after the last one holding records.
+     *
+     * @param path Log file, or the prefix of its segment files
+     * @param segment_size Bytes per segment (0 = a single, ever-growing file); rounded up to
+     *        whole blocks in direct mode
+     * @param direct Write framed 4 KB blocks with O_DIRECT. Where the filesystem refuses
+     *        O_DIRECT the same format goes through the page cache (see direct_io())
+     * @return std::unique_ptr<WalWriter> The writer, or nullptr if the log could not be opened or
+     *         is a single file already holding records in the other format (text or framed)
+     */
+    static std::unique_ptr<WalWriter> open(const std::string& path, size_t segment_size, WalDurability durability,
+                                           bool direct = false);
+
+    /**
+     * @brief Files of the log at @p path in replay order (the single file first if both exist)
+     */
+    static std::vector<std::string> files(const std::string& path);
+
+    /**
+     * @brief Write out any buffered records and close the log
+     */
+    ~WalWriter();
+
+    WalWriter(const WalWriter&) = delete;
+    WalWriter& operator=(const WalWriter&) = delete;
+
+    /**
+     * @brief Append one record, the concatenation of @p parts (owner-serialized)
+     *
+     * @return true if a new segment was started for it
+     */
+    bool append(std::initializer_list<std::string_view> parts);
+
+    /**
+     * @brief Write out buffered records (owner-serialized)
+     */
+    void flush();
+
+    /**
+     * @brief Wait until every record appended so far is written (and synced under Sync)
+     *
+     * A no-op under Buffered durability and for a text log, which append() writes itself.
+     * Call it after releasing the lock that serializes append(): a direct-mode writer then
+     * writes the records of every waiting caller together.
+     */
+    void commit();
+
+    /**
+     * @brief Start a new segment for the following records (owner-serialized)
+     *
+     * @return uint64_t The new segment's number (0 for a single-file log, which cannot roll)
+     */
+    uint64_t roll();
+
+    /**
+     * @brief Records to write at the head of every segment started from now on (owner-serialized)
+     *
+     * @param records Whole records, each ending in a newline
+     */
+    void set_segment_header(std::vector<std::string> records) {
+        segment_header_ = std::move(records);
+    }
+
+    /**
+     * @brief Whether writes bypass the page cache (false if direct mode fell back to buffered I/O)
+     */
+    bool direct_io() const {
+        return direct_io_;
+    }
+
+    /**
+     * @brief Whether a write, sync or segment open has failed, so records may be missing
+     *
+     * Sticky: once set it stays set for the life of the writer.
+     */
+    bool failed() const {
+        return failed_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Whether fewer spare segments are ready than prepare_segments() keeps
+     */
+    bool needs_segments() const;
+
+    /**
+     * @brief Create preallocated spare segments until enough are ready
+     */
+    void prepare_segments();
+
+    /**
+     * @brief Recycle every segment numbered below @p first_kept, whose records a checkpoint covers
+     *
+     * Up to the spare limit they are zeroed and renumbered as spares; the rest are deleted.
+     */
+    void recycle(uint64_t first_kept);
+
+private:
+    struct AlignedFree {
+        void operator()(char* buffer) const {
+            std::free(buffer);
+        }
+    };
+
+    WalWriter(std::string path, size_t segment_size, WalDurability durability, bool direct);
+
+    /**
+     * @brief Open a log file for writing, with O_DIRECT while the filesystem allows it
+     */
+    int open_log(const std::string& path, int flags);
+
+    /**
+     * @brief Give a prepared file at @p temp_path the next free segment number (mutex_ must be held)
+     */
+    bool publish_segment(const std::string& temp_path);
+
+    /**
+     * @brief Write out buffer_, starting the next segment first if it does not fit
+     *
+     * @return true if a new segment was started
+     */
+    bool write_buffer();
+
+    /**
+     * @brief Close the current segment and open the next one, creating it if no spare is ready
+     */
+    bool open_next_segment();
+
+    /**
+     * @brief Write the segment header records at the start of a newly opened segment
+     */
+    void write_segment_header();
+
+    /**
+     * @brief Append one record to the framed blocks (direct mode)
+     */
+    bool append_framed(std::initializer_list<std::string_view> parts, size_t size);
+
+    /**
+     * @brief Copy one record into the current block, marking where it starts (io_mutex_ held)
+     */
+    void put_record(std::unique_lock<std::mutex>& lock, std::initializer_list<std::string_view> parts);
+
+    /**
+     * @brief Copy bytes into the current block, sealing blocks as they fill (io_mutex_ held)
+     */
+    void put_bytes(std::unique_lock<std::mutex>& lock, const char* data, size_t size);
+
+    /**
+     * @brief Seal the current block; once the buffer is full, wait for the I/O thread to take it
+     */
+    void finish_block(std::unique_lock<std::mutex>& lock);
+
+    /**
+     * @brief Have the I/O thread write every record so far and wait for it (direct mode)
+     */
+    void flush_blocks();
+
+    /**
+     * @brief Take the filled blocks and the partial one, swap buffers and write them out
+     *        (I/O thread; io_mutex_ held except while writing)
+     */
+    void write_blocks(std::unique_lock<std::mutex>& lock);
+
+    void io_loop();
+
+    char* block(size_t index) const {
+        return buffers_[active_].get() + index * kBlockSize;
+    }
+
+    static constexpr size_t kBlockSize = 4096;
+    static constexpr size_t kBufferBlocks = 16;
+
+    std::string path_;
+    size_t segment_size_;
+    WalDurability durability_;
+    int fd_ = -1;
+    uint64_t offset_ = 0; // Write position in the current segment
+    std::string buffer_;
+    std::vector<std::string> segment_header_;
+    bool segment_used_ = false; // Whether the current segment has records past its header
+    std::atomic<bool> failed_{false}; // Also set by the I/O thread
+
+    // Direct mode: the buffer being filled holds blocks_ready_ sealed blocks, then the
+    // current block with fill_ payload bytes; offset_ is where its first block goes
+    bool framed_;
+    bool direct_io_;
+    std::unique_ptr<char, AlignedFree> buffers_[2];
+    std::unique_ptr<char, AlignedFree> shadow_; // Shadow copy of a block completing in place
+    int active_ = 0;
+    size_t blocks_ready_ = 0;
+    size_t fill_ = 0;
+    uint16_t first_record_;
+    uint64_t image_offset_ = UINT64_MAX; // Partial block whose image was written last
+    bool image_shadow_ = false;          // Whether that image is in the shadow slot
+
+    // I/O thread writing out one buffer while the other fills. io_mutex_ guards the
+    // buffer state above between the owner and the I/O thread; counts are of records
+    std::thread io_thread_;
+    std::mutex io_mutex_;
+    std::condition_variable io_cv_;
+    uint64_t appended_ = 0;
+    uint64_t requested_ = 0; // Records to write out as soon as possible
+    uint64_t written_ = 0;
+    bool io_stop_ = false;
+
+    // Segment numbers: oldest kept, being written, and highest existing (the spares follow current_)
+    mutable std::mutex mutex_;
+    uint64_t first_ = 0;
+    uint64_t current_ = 0;
+    uint64_t last_ = 0;
+
+    // Serializes prepare_segments() and recycle(), which share a temporary file name
+    std::mutex maintenance_mutex_;
+};
+
+/**
+ * @brief Reads the records of one log file, plain text or framed by a direct-mode writer.
+ *
+ * Reading stops at the end of the file's records: the first zero byte of a text file, or
+ * the first unwritten block of a framed one. A framed block is read together with the
+ * shadow image after it, if any, and the longer intact image wins. Blocks that fail
+ * their checksum are skipped along with any record crossing them.
+ */
+class WalReader {
+public:
+    explicit WalReader(const std::string& path);
+
+    bool is_open() const {
+        return in_.is_open();
+    }
+
+    /**
+     * @brief Read the next record (without its newline)
+     *
+     * @return false at the end of the file's records
+     */
+    bool next(std::string& line);
+
+    /**
+     * @brief Position of the next record to read, to seek() back to later
+     */
+    uint64_t position() const {
+        return position_;
+    }
+
+    /**
+     * @brief Continue reading at a position() reported earlier
+     */
+    void seek(uint64_t position);
+
+private:
+    bool next_framed(std::string& line);
+
+    /**
+     * @brief Read and check a framed block into block_, or its shadow image if that is longer
+     *
+     * @return false if the block is past the end of the file or unwritten
+     */
+    bool load_block(uint64_t index);
+
+    std::ifstream in_;
+    bool framed_ = false;
+    uint64_t position_ = 0;
+
+    std::string block_;
+    uint64_t block_index_ = UINT64_MAX;
+    bool block_valid_ = false;
+    size_t block_length_ = 0;
+    uint16_t block_first_ = 0;
+};
+
+} // namespace kvstore
+
+#endif // WAL_WRITER_HPP
@@ -0,0 +1,401 @@
+#include "arena.hpp"
+#include "numa.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace kvstore {
+
+namespace {
+
+constexpr size_t kAlignment = 16;
+
+// Huge page sizes: the PMD size transparent huge pages use, and the 1 GB hugetlb size
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+constexpr size_t kGiantPageSize = 1024 * 1024 * 1024;
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t os_page_size() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+} // namespace
+
+Arena::Arena(const ArenaOptions& options) : options_(options) {
+    if (options_.huge_pages == HugePages::Transparent) {
+        options_.huge_page_size = kHugePageSize; // THP always uses PMD-sized pages
+    }
+    if (options_.huge_pages == HugePages::Explicit && options_.huge_page_size != kHugePageSize &&
+        options_.huge_page_size != kGiantPageSize) {
+        throw std::invalid_argument("huge_page_size must be 2 MB or 1 GB");
+    }
+    if (options_.huge_pages != HugePages::Off) {
+        // Slab pages stay 2 MB under 1 GB pages, which only back large allocations
+        options_.page_size = kHugePageSize;
+    }
+    
+    // Slots find their page header by masking, so pages are a power of two in size
+    size_t page_size = os_page_size();
+    while (page_size < std::max<size_t>(options_.page_size, 64 * 1024)) {
+        page_size *= 2;
+    }
+    options_.page_size = page_size;
+    header_size_ = round_up(sizeof(Page), 64);
+    max_small_size_ = options_.page_size / 8;
+    
+    // Classes step by 16 bytes up to 128, then grow by ~25% so slack stays under a quarter
+    size_t slot = kAlignment;
+    while (slot <= max_small_size_) {
+        classes_.push_back(SizeClass{slot, nullptr});
+        size_t step = slot < 128 ? kAlignment : round_up(slot / 4, kAlignment);
+        slot += step;
+    }
+    max_small_size_ = classes_.back().slot_size;
+    
+    class_lookup_.resize(max_small_size_ / kAlignment + 1);
+    size_t index = 0;
+    for (size_t units = 0; units < class_lookup_.size(); ++units) {
+        while (classes_[index].slot_size < units * kAlignment) {
+            index++;
+        }
+        class_lookup_[units] = static_cast<uint8_t>(index);
+    }
+}
+
+Arena::~Arena() {
+    while (all_pages_) {
+        Page* page = all_pages_;
+        all_pages_ = page->all_next;
+        unmap(page, options_.page_size, page->huge);
+    }
+}
+
+void* Arena::allocate(size_t size) {
+    size = std::max<size_t>(size, 1);
+    
+    if (size > max_small_size_) {
+        size_t length = large_length(size);
+        bool huge = false;
+        void* ptr = map(length, os_page_size(), huge);
+        std::lock_guard<std::mutex> lock(mutex_);
+        allocated_bytes_ += length;
+        mapped_bytes_ += length;
+        if (huge) {
+            huge_page_bytes_ += length;
+            huge_large_.emplace(ptr, length);
+        }
+        return ptr;
+    }
+    
+    size_t size_class = size_class_of(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    SizeClass& cls = classes_[size_class];
+    Page* page = cls.partial ? cls.partial : new_page(size_class);
+    
+    void* slot;
+    if (page->free_list) {
+        slot = page->free_list;
+        page->free_list = *static_cast<void**>(slot);
+    } else {
+        slot = page->bump;
+        page->bump += cls.slot_size;
+    }
+    
+    page->live++;
+    cls.live++;
+    if (page->live == page->capacity) {
+        unlink_partial(page);
+    }
+    allocated_bytes_ += cls.slot_size;
+    return slot;
+}
+
+void Arena::deallocate(void* ptr, size_t size) noexcept {
+    if (!ptr) {
+        return;
+    }
+    size = std::max<size_t>(size, 1);
+    
+    if (size > max_small_size_) {
+        size_t length = large_length(size);
+        std::lock_guard<std::mutex> lock(mutex_);
+        allocated_bytes_ -= length;
+        unmap(ptr, length, huge_large_.erase(ptr) > 0);
+        return;
+    }
+    
+    // Slab pages are page_size aligned, so the header is found by masking the address
+    Page* page = reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(ptr) & ~(options_.page_size - 1));
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    SizeClass& cls = classes_[page->size_class];
+    
+    *static_cast<void**>(ptr) = page->free_list;
+    page->free_list = ptr;
+    page->live--;
+    cls.live--;
+    allocated_bytes_ -= cls.slot_size;
+    
+    if (!page->in_partial) {
+        link_partial(page);
+    }
+    
+    // Keep the last partial page of a class around so alloc/free at a page boundary
+    // does not map and unmap on every call
+    if (page->live == 0 && (page->prev || page->next)) {
+        release_page(page);
+    }
+}
+
+bool Arena::should_relocate(const void* ptr, size_t size) const {
+    if (!ptr || std::max<size_t>(size, 1) > max_small_size_) {
+        return false; // Large allocations have their own mapping and never fragment
+    }
+    
+    const Page* page = reinterpret_cast<const Page*>(reinterpret_cast<uintptr_t>(ptr) & ~(options_.page_size - 1));
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    const SizeClass& cls = classes_[page->size_class];
+    if (!page->in_partial || page == cls.partial) {
+        return false; // Full, or the page a new allocation would land on anyway
+    }
+    // page->live / page->capacity < cls.live / cls.capacity
+    return static_cast<uint64_t>(page->live) * cls.capacity <
+           static_cast<uint64_t>(cls.live) * page->capacity;
+}
+
+size_t Arena::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t released = 0;
+    Page* page = all_pages_;
+    while (page) {
+        Page* next = page->all_next;
+        if (page->live == 0) {
+            release_page(page);
+            released += options_.page_size;
+        }
+        page = next;
+    }
+    return released;
+}
+
+size_t Arena::allocated_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocated_bytes_;
+}
+
+size_t Arena::mapped_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return mapped_bytes_;
+}
+
+size_t Arena::huge_page_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return huge_page_bytes_;
+}
+
+size_t Arena::large_length(size_t size) const {
+    // Only allocations of at least one huge page are worth rounding up to huge pages
+    if (options_.huge_pages != HugePages::Off && size >= options_.huge_page_size) {
+        return round_up(size, options_.huge_page_size);
+    }
+    return round_up(size, os_page_size());
+}
+
+void* Arena::map(size_t length, size_t alignment, bool& huge) {
+    huge = false;
+    bool huge_sized = options_.huge_pages != HugePages::Off && length % options_.huge_page_size == 0;
+    
+    // Transparent huge pages cover any 2 MB multiple, so also slab pages under 1 GB pages
+    bool transparent_sized = options_.huge_pages != HugePages::Off && length % kHugePageSize == 0;
+    
+#ifdef MAP_HUGETLB
+    if (huge_sized && options_.huge_pages == HugePages::Explicit) {
+        // hugetlb mappings are naturally aligned to the huge page size
+        int size_flag = 0;
+#ifdef MAP_HUGE_SHIFT
+        size_flag = __builtin_ctzll(options_.huge_page_size) << MAP_HUGE_SHIFT;
+#endif
+        void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+        if (ptr != MAP_FAILED) {
+            huge = true;
+            if (options_.numa_node >= 0) {
+                numa::bind_memory(ptr, length, options_.numa_node);
+            }
+            return ptr;
+        }
+        // No reserved huge pages available: fall back to transparent huge pages
+    }
+#endif
+    
+    if (transparent_sized) {
+        alignment = std::max(alignment, kHugePageSize);
+    }
+    
+    // Over-map so an aligned range can be carved out, then trim both ends
+    size_t padded = alignment > os_page_size() ? length + alignment : length;
+    void* raw = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = round_up(start, alignment);
+    if (aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    size_t tail = (start + padded) - (aligned + length);
+    if (tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + length), tail);
+    }
+    
+    void* ptr = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    if (transparent_sized) {
+        madvise(ptr, length, MADV_HUGEPAGE);
+    }
+#endif
+    if (options_.numa_node >= 0) {
+        numa::bind_memory(ptr, length, options_.numa_node);
+    }
+    return ptr;
+}
+
+void Arena::unmap(void* ptr, size_t length, bool huge) {
+    munmap(ptr, length);
+    mapped_bytes_ -= length;
+    huge_page_bytes_ -= huge ? length : 0;
+}
+
+Arena::Page* Arena::new_page(size_t size_class) {
+    bool huge = false;
+    void* memory = map(options_.page_size, options_.page_size, huge);
+    mapped_bytes_ += options_.page_size;
+    huge_page_bytes_ += huge ? options_.page_size : 0;
+    
+    Page* page = new (memory) Page();
+    page->huge = huge;
+    size_t slot_size = classes_[size_class].slot_size;
+    page->size_class = static_cast<uint32_t>(size_class);
+    page->bump = static_cast<char*>(memory) + header_size_;
+    page->capacity = static_cast<uint32_t>((options_.page_size - header_size_) / slot_size);
+    page->end = page->bump + page->capacity * slot_size;
+    classes_[size_class].capacity += page->capacity;
+    
+    page->all_next = all_pages_;
+    if (all_pages_) {
+        all_pages_->all_prev = page;
+    }
+    all_pages_ = page;
+    
+    link_partial(page);
+    return page;
+}
+
+void Arena::release_page(Page* page) {
+    unlink_partial(page);
+    classes_[page->size_class].capacity -= page->capacity;
+    
+    if (page->all_prev) {
+        page->all_prev->all_next = page->all_next;
+    } else {
+        all_pages_ = page->all_next;
+    }
+    if (page->all_next) {
+        page->all_next->all_prev = page->all_prev;
+    }
+    
+    unmap(page, options_.page_size, page->huge);
+}
+
+void Arena::link_partial(Page* page) {
+    SizeClass& cls = classes_[page->size_class];
+    page->prev = nullptr;
+    page->next = cls.partial;
+    if (cls.partial) {
+        cls.partial->prev = page;
+    }
+    cls.partial = page;
+    page->in_partial = true;
+}
+
+void Arena::unlink_partial(Page* page) {
+    if (!page->in_partial) {
+        return;
+    }
+    
+    SizeClass& cls = classes_[page->size_class];
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        cls.partial = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->prev = nullptr;
+    page->next = nullptr;
+    page->in_partial = false;
+}
+
+ArenaBuffer::ArenaBuffer(Arena& arena, const char* data, size_t size) {
+    if (size <= kInlineCapacity) {
+        std::copy(data, data + size, bytes_);
+        set_inline_size(size);
+        return;
+    }
+    char* copy = static_cast<char*>(arena.allocate(size));
+    std::copy(data, data + size, copy);
+    set_out_of_line(copy, &arena, size);
+}
+
+ArenaBuffer ArenaBuffer::borrow(const char* data, size_t size) noexcept {
+    ArenaBuffer buffer;
+    buffer.set_out_of_line(data, nullptr, size);
+    return buffer;
+}
+
+ArenaBuffer::ArenaBuffer(ArenaBuffer&& other) noexcept {
+    std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+    other.set_inline_size(0);
+}
+
+ArenaBuffer& ArenaBuffer::operator=(ArenaBuffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        other.set_inline_size(0);
+    }
+    return *this;
+}
+
+void ArenaBuffer::reset() noexcept {
+    if (!is_inline()) {
+        Arena* arena = load<Arena*>(kArenaOffset);
+        if (arena) {
+            arena->deallocate(const_cast<char*>(data()), size());
+        }
+    }
+    set_inline_size(0);
+}
+
+void ArenaBuffer::set_out_of_line(const char* data, Arena* arena, size_t size) {
+    // The tag must land in byte 23, the most significant byte of the size word
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "ArenaBuffer layout assumes little-endian");
+    std::memcpy(bytes_ + kDataOffset, &data, sizeof(data));
+    std::memcpy(bytes_ + kArenaOffset, &arena, sizeof(arena));
+    size_t word = (size & kSizeMask) | (static_cast<size_t>(kOutOfLineTag) << 56);
+    std::memcpy(bytes_ + kSizeOffset, &word, sizeof(word));
+}
+
+} // namespace kvstore
@@ -0,0 +1,57 @@
+#include "background_worker.hpp"
+#include "numa.hpp"
+
+namespace kvstore {
+
+BackgroundWorker::~BackgroundWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void BackgroundWorker::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&BackgroundWorker::run, this);
+        }
+    }
+    cv_.notify_one();
+}
+
+void BackgroundWorker::run() {
+    if (numa_node_ >= 0) {
+        numa::pin_current_thread(numa_node_);
+    }
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    
+    while (true) {
+        cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            return; // Stopping and fully drained
+        }
+        
+        {
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            
+            lock.unlock();
+            try {
+                task();
+            } catch (...) {
+                // Background tasks have no caller to report to
+            }
+        } // Task and its captures are destroyed here, before re-taking the lock
+        lock.lock();
+    }
+}
+
+} // namespace kvstore
@@ -0,0 +1,97 @@
+#include "hot_key_replicas.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace kvstore {
+
+HotKeyReplicas::HotKeyReplicas(size_t slots) {
+    slot_count_ = slots > 0 ? slots : std::max(1u, std::thread::hardware_concurrency());
+    slots_ = std::make_unique<Slot[]>(slot_count_);
+}
+
+std::optional<std::string> HotKeyReplicas::get(const std::string& key) const {
+    std::shared_ptr<const std::string> value;
+    {
+        Slot& slot = local_slot();
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        auto it = slot.values.find(key);
+        if (it == slot.values.end()) {
+            return std::nullopt;
+        }
+        it->second.hits++;
+        value = it->second.value;
+    }
+    // Copy out after releasing the slot lock
+    return *value;
+}
+
+void HotKeyReplicas::install(const std::string& key, const std::string& value) {
+    if (keys_.insert(key).second) {
+        count_.fetch_add(1, std::memory_order_release);
+    }
+    
+    for (size_t i = 0; i < slot_count_; ++i) {
+        // Separate copies so cores do not share the value's cache lines
+        auto copy = std::make_shared<const std::string>(value);
+        std::lock_guard<std::mutex> lock(slots_[i].mutex);
+        slots_[i].values[key].value = std::move(copy);
+    }
+}
+
+void HotKeyReplicas::invalidate(const std::string& key) {
+    if (keys_.erase(key) == 0) {
+        return;
+    }
+    
+    for (size_t i = 0; i < slot_count_; ++i) {
+        std::lock_guard<std::mutex> lock(slots_[i].mutex);
+        slots_[i].values.erase(key);
+    }
+    count_.fetch_sub(1, std::memory_order_release);
+}
+
+void HotKeyReplicas::clear() {
+    if (keys_.empty()) {
+        return;
+    }
+    
+    for (size_t i = 0; i < slot_count_; ++i) {
+        std::lock_guard<std::mutex> lock(slots_[i].mutex);
+        slots_[i].values.clear();
+    }
+    keys_.clear();
+    count_.store(0, std::memory_order_release);
+}
+
+std::unordered_map<std::string, uint64_t> HotKeyReplicas::take_hits() {
+    std::unordered_map<std::string, uint64_t> hits;
+    for (size_t i = 0; i < slot_count_; ++i) {
+        std::lock_guard<std::mutex> lock(slots_[i].mutex);
+        for (auto& entry : slots_[i].values) {
+            if (entry.second.hits > 0) {
+                hits[entry.first] += entry.second.hits;
+                entry.second.hits = 0;
+            }
+        }
+    }
+    return hits;
+}
+
+HotKeyReplicas::Slot& HotKeyReplicas::local_slot() const {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+        return slots_[static_cast<size_t>(cpu) % slot_count_];
+    }
+#endif
+    size_t hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return slots_[hash % slot_count_];
+}
+
+} // namespace kvstore
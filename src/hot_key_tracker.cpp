@@ -0,0 +1,73 @@
+#include "hot_key_tracker.hpp"
+
+#include <algorithm>
+
+namespace kvstore {
+
+HotKeyTracker::HotKeyTracker(size_t capacity, uint32_t sample_rate)
+    : capacity_(capacity), sample_rate_(std::max<uint32_t>(sample_rate, 1)) {
+    counters_.reserve(capacity_);
+    index_.reserve(capacity_);
+}
+
+uint32_t HotKeyTracker::next_gap() {
+    // xorshift32: cheap and good enough to break up periodic access patterns
+    rng_state_ ^= rng_state_ << 13;
+    rng_state_ ^= rng_state_ >> 17;
+    rng_state_ ^= rng_state_ << 5;
+    return 1 + rng_state_ % (2 * sample_rate_ - 1);
+}
+
+void HotKeyTracker::add(const std::string& key, uint64_t count) {
+    if (capacity_ == 0 || count == 0) {
+        return;
+    }
+    
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        counters_[it->second].count += count;
+        return;
+    }
+    
+    if (counters_.size() < capacity_) {
+        index_.emplace(key, counters_.size());
+        counters_.push_back(HotKey{key, count, 0});
+        return;
+    }
+    
+    // Replace the smallest counter; the newcomer inherits its count as error
+    auto victim = std::min_element(counters_.begin(), counters_.end(),
+                                   [](const HotKey& a, const HotKey& b) { return a.count < b.count; });
+    size_t slot = static_cast<size_t>(victim - counters_.begin());
+    
+    index_.erase(victim->key);
+    victim->error = victim->count;
+    victim->count += count;
+    victim->key = key;
+    index_.emplace(key, slot);
+}
+
+void HotKeyTracker::decay() {
+    for (HotKey& counter : counters_) {
+        counter.count /= 2;
+        counter.error /= 2;
+    }
+}
+
+std::vector<HotKey> HotKeyTracker::top(size_t k) const {
+    std::vector<HotKey> result(counters_);
+    std::sort(result.begin(), result.end(),
+              [](const HotKey& a, const HotKey& b) { return a.count > b.count; });
+    if (result.size() > k) {
+        result.resize(k);
+    }
+    return result;
+}
+
+void HotKeyTracker::clear() {
+    counters_.clear();
+    index_.clear();
+    countdown_ = 1;
+}
+
+} // namespace kvstore
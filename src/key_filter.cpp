@@ -0,0 +1,102 @@
+#include "key_filter.hpp"
+
+#include <algorithm>
+
+namespace kvstore {
+
+namespace {
+
+constexpr size_t kCountersPerKey = 10;
+constexpr size_t kCountersPerBlock = 128;
+constexpr uint8_t kMaxCount = 15;
+
+// MurmurHash3's 64-bit finalizer: decorrelates the probe bits from the block choice
+uint64_t remix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+} // namespace
+
+KeyFilter::KeyFilter(size_t expected_keys)
+    : block_count_(std::max<size_t>(1, (expected_keys * kCountersPerKey + kCountersPerBlock - 1) /
+                                           kCountersPerBlock)) {
+    // Every block starts in generation 0, before the current one, so none needs zeroing here
+    blocks_.reset(new Block[block_count_]);
+    generations_.reset(new std::atomic<uint32_t>[block_count_]());
+}
+
+size_t KeyFilter::block_index(uint64_t hash) const {
+    // Multiply-shift maps the high half onto [0, block_count_) without a division
+    return ((hash >> 32) * block_count_) >> 32;
+}
+
+bool KeyFilter::may_contain(uint64_t hash) const {
+    size_t index = block_index(hash);
+    if (generations_[index].load(std::memory_order_acquire) != generation_.load(std::memory_order_relaxed)) {
+        return false; // Nothing counted in it since the last clear()
+    }
+    const Block& block = blocks_[index];
+    uint64_t probes = remix(hash);
+    for (int i = 0; i < kProbes; ++i, probes >>= 7) {
+        size_t counter = probes & (kCountersPerBlock - 1);
+        uint8_t byte = block.bytes[counter / 2].load(std::memory_order_acquire);
+        if (((byte >> (counter % 2 * 4)) & 0xF) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void KeyFilter::add(uint64_t hash) {
+    update(hash, 1);
+}
+
+void KeyFilter::remove(uint64_t hash) {
+    update(hash, -1);
+}
+
+void KeyFilter::update(uint64_t hash, int delta) {
+    size_t index = block_index(hash);
+    Block& block = blocks_[index];
+    uint32_t generation = generation_.load(std::memory_order_relaxed);
+    bool stale = generations_[index].load(std::memory_order_relaxed) != generation;
+    if (stale) {
+        if (delta < 0) {
+            return; // Its counters were dropped by clear()
+        }
+        for (auto& byte : block.bytes) {
+            byte.store(0, std::memory_order_relaxed);
+        }
+    }
+    uint64_t probes = remix(hash);
+    for (int i = 0; i < kProbes; ++i, probes >>= 7) {
+        size_t counter = probes & (kCountersPerBlock - 1);
+        int shift = counter % 2 * 4;
+        // Writers are serialized, so a plain load and store cannot lose an update
+        uint8_t byte = block.bytes[counter / 2].load(std::memory_order_relaxed);
+        uint8_t count = (byte >> shift) & 0xF;
+        if (count == kMaxCount || (count == 0 && delta < 0)) {
+            continue;
+        }
+        count = static_cast<uint8_t>(count + delta);
+        byte = static_cast<uint8_t>((byte & ~(0xF << shift)) | (count << shift));
+        block.bytes[counter / 2].store(byte, std::memory_order_release);
+    }
+    if (stale) {
+        // Readers treat the block as empty until its fresh counters are all in place
+        generations_[index].store(generation, std::memory_order_release);
+    }
+}
+
+void KeyFilter::clear() {
+    // A wrapped generation can only revive old counts, which means false positives
+    uint32_t next = generation_.load(std::memory_order_relaxed) + 1;
+    generation_.store(next == 0 ? 1 : next, std::memory_order_relaxed);
+}
+
+} // namespace kvstore
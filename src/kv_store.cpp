@@ -1,85 +1,532 @@
 #include "kv_store.hpp"
+#include "hash.hpp"
+#include "lz4.hpp"
+#include <algorithm>
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
 #include <iostream>
+#include <thread>
+#include <unordered_set>
 
 namespace kvstore {
 
+namespace {
+
+// Fixed per-entry bookkeeping charged on top of key and value bytes: the hash node,
+// the LRU list node and the GDSF queue node
+constexpr size_t kEntryOverhead = 128;
+
+// Entries evicted per lock hold by the background reclaimer
+constexpr size_t kReclaimBatch = 64;
+
+// Slow-path hits between re-picks of the replicated hot keys
+constexpr uint64_t kReplicaRefreshInterval = 1024;
+
+// Tables with at least this many entries are torn down off the calling thread
+constexpr size_t kAsyncTeardownThreshold = 4096;
+
+// Writes between fragmentation checks; doubled (up to the max) after a pass that moved nothing
+constexpr uint64_t kDefragCheckInterval = 1024;
+constexpr uint64_t kMaxDefragCheckInterval = 1024 * 1024;
+
+// Fragmentation below this many wasted bytes is not worth a pass
+constexpr size_t kDefragMinWaste = 1024 * 1024;
+
+// Buckets scanned between deadline checks
+constexpr size_t kDefragBucketBatch = 64;
+
+// Entries compressed into the cold tier per write, at most
+constexpr size_t kColdBatch = 2;
+
+// Values below this size, or saving under an eighth, are kept cold but uncompressed
+constexpr size_t kMinCompressSize = 64;
+
+// Compression scratch space kept between calls, at most
+constexpr size_t kMaxScratchSize = 1024 * 1024;
+
+// Values sampled to train a dictionary
+constexpr size_t kDictionarySamples = 1024;
+
+// Log lines read per slice of a background recovery
+constexpr size_t kRecoveryBatch = 1024;
+
+// Snapshot bytes gathered per locked slice and written out at once
+constexpr size_t kSnapshotChunk = 1024 * 1024;
+
+// Longest sleep of a rate-limited snapshot between checks for cancellation
+constexpr auto kSnapshotThrottleStep = std::chrono::milliseconds(10);
+
+// Seeds of the key fingerprint and its independent checksum
+constexpr uint64_t kFingerprintSeed = 0x243F6A8885A308D3ull;
+constexpr uint64_t kChecksumSeed = 0x13198A2E03707344ull;
+constexpr uint64_t kFilterSeed = 0xA4093822299F31D0ull;
+
+// Seed of the key hashes the negative cache stores in place of the keys
+constexpr uint64_t kNegativeSeed = 0x082EFA98EC4E6C89ull;
+
+// WAL payloads that are binary (compressed values, dictionaries) are logged as base64
+const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(const char* data, size_t size) {
+    std::string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t chunk = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < size) {
+            chunk |= static_cast<uint8_t>(data[i + 1]) << 8;
+        }
+        if (i + 2 < size) {
+            chunk |= static_cast<uint8_t>(data[i + 2]);
+        }
+        out.push_back(kBase64Alphabet[(chunk >> 18) & 63]);
+        out.push_back(kBase64Alphabet[(chunk >> 12) & 63]);
+        out.push_back(i + 1 < size ? kBase64Alphabet[(chunk >> 6) & 63] : '=');
+        out.push_back(i + 2 < size ? kBase64Alphabet[chunk & 63] : '=');
+    }
+    return out;
+}
+
+bool base64_decode(const std::string& text, std::string& out) {
+    out.clear();
+    uint32_t chunk = 0;
+    int bits = 0;
+    for (char c : text) {
+        if (c == '=') {
+            break;
+        }
+        const char* pos = std::strchr(kBase64Alphabet, c);
+        if (!pos || c == '\0') {
+            return false;
+        }
+        chunk = (chunk << 6) | static_cast<uint32_t>(pos - kBase64Alphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((chunk >> bits) & 0xff));
+        }
+    }
+    return true;
+}
+
+// A DICT log line, as written ahead of the values compressed against the dictionary
+std::string dictionary_record(uint32_t version, const std::string& content) {
+    return "DICT " + std::to_string(version) + " " + base64_encode(content.data(), content.size()) + "\n";
+}
+
+// The dictionary a record's version number refers to, or nullptr if its DICT record is missing
+using DictionaryLookup = std::function<const lz4::Dictionary*(uint32_t version)>;
+
+// Decode a PUT or PUTZ log line, or a snapshot's PUTS line referring to a SHARED value;
+// compressed values need the dictionary version they name
+bool decode_put(const std::string& line, std::string& key, std::string& value, const DictionaryLookup& dictionaries,
+                const std::unordered_map<uint64_t, std::string>* shared = nullptr) {
+    std::istringstream iss(line);
+    std::string op;
+    if (!(iss >> op >> key)) {
+        return false;
+    }
+    
+    if (op == "PUT") {
+        std::getline(iss, value);
+        if (!value.empty() && value[0] == ' ') {
+            value = value.substr(1); // Remove leading space
+        }
+        return true;
+    }
+    
+    uint32_t version;
+    size_t raw_size;
+    std::string compressed;
+    if (op == "PUTS") {
+        uint64_t id;
+        if (!shared || !(iss >> id >> version >> raw_size)) {
+            return false;
+        }
+        auto pooled = shared->find(id);
+        if (pooled == shared->end()) {
+            return false; // Its SHARED record is missing
+        }
+        if (raw_size == 0) {
+            value = pooled->second;
+            return true;
+        }
+        compressed = pooled->second;
+    } else {
+        std::string payload;
+        if (op != "PUTZ" || !(iss >> version >> raw_size >> payload) || !base64_decode(payload, compressed)) {
+            return false;
+        }
+    }
+    const lz4::Dictionary* dictionary = nullptr;
+    if (version != 0 && !(dictionary = dictionaries(version))) {
+        return false; // Its DICT record is missing
+    }
+    value.assign(raw_size, '\0');
+    return lz4::decompress(compressed.data(), compressed.size(), &value[0], raw_size, dictionary);
+}
+
+} // namespace
+
 KVStore::KVStore(size_t max_capacity, const std::string& wal_path)
-    : max_capacity_(max_capacity), wal_path_(wal_path) {
+    : KVStore(StoreOptions{max_capacity, 0, EvictionPolicy::LRU, wal_path}) {
+}
+
+KVStore::KVStore(const StoreOptions& options)
+    : KVStore(options, nullptr, nullptr) {
+}
+
+KVStore::KVStore(const StoreOptions& options, std::shared_ptr<BackgroundWorker> background,
+                 std::shared_ptr<Arena> arena)
+    : arena_(arena ? std::move(arena) : std::make_shared<Arena>(ArenaOptions{options.numa_node, 256 * 1024, options.huge_pages, options.huge_page_size})),
+      cache_(0, ArenaBufferHash(), std::equal_to<ArenaBuffer>(), CacheMap::allocator_type(arena_.get())),
+      lru_list_(KeyList::allocator_type(arena_.get())),
+      priority_queue_(PriorityQueue::allocator_type(arena_.get())),
+      max_capacity_(options.max_capacity),
+      max_bytes_(options.max_bytes),
+      eviction_policy_(options.eviction_policy),
+      hot_keys_(options.hot_key_capacity, options.hot_key_sample_rate),
+      background_eviction_(options.background_eviction),
+      high_watermark_(options.high_watermark),
+      low_watermark_(options.low_watermark),
+      active_defrag_(options.active_defrag),
+      defrag_threshold_(options.defrag_threshold),
+      defrag_slice_(options.defrag_slice),
+      defrag_check_interval_(kDefragCheckInterval),
+      compress_cold_(options.compress_cold),
+      cold_fraction_(options.cold_fraction),
+      cold_boundary_(lru_list_.end()),
+      compress_values_(options.compress_values),
+      fingerprint_size_(options.fingerprint_keys ? (options.fingerprint_checksum ? 12 : 8) : 0),
+      dedup_values_(options.dedup_values),
+      value_pool_(0, ArenaBufferHash(), std::equal_to<ArenaBuffer>(), ValuePool::allocator_type(arena_.get())),
+      lazy_free_threshold_(options.lazy_free_threshold),
+      wal_path_(options.wal_path),
+      wal_durability_(options.wal_durability),
+      numa_node_(options.numa_node),
+      background_(std::move(background)) {
+    if (!options.persistent_path.empty()) {
+        persistent_table_ = MappedTable::open_file(options.persistent_path, options.persistent_slots,
+                                                   options.persistent_slot_size, options.persistent_sync);
+        if (!persistent_table_) {
+            std::cerr << "Warning: Failed to open persistent file: " << options.persistent_path << std::endl;
+        }
+    }
+    if (options.key_filter && persistent_table_) {
+        std::cerr << "Warning: The key filter only covers memory; not using it with a persistent file" << std::endl;
+    } else if (options.key_filter) {
+        key_filter_ = std::make_unique<KeyFilter>(max_capacity_);
+    }
+    if (!options.shared_memory_name.empty() && fingerprint_size_ > 0) {
+        std::cerr << "Warning: Shared memory needs full keys; not publishing with fingerprint_keys" << std::endl;
+    } else if (!options.shared_memory_name.empty()) {
+        shared_table_ = MappedTable::create_shared(options.shared_memory_name, options.shared_memory_slots,
+                                                   options.shared_memory_slot_size);
+        if (!shared_table_) {
+            std::cerr << "Warning: Failed to create shared memory: " << options.shared_memory_name << std::endl;
+        }
+    }
+    if (options.hot_key_replication && options.hot_key_capacity > 0) {
+        replicas_ = std::make_unique<HotKeyReplicas>();
+        replicated_hot_keys_ = options.replicated_hot_keys;
+    }
+
     if (!wal_path_.empty()) {
-        wal_file_ = std::make_unique<std::ofstream>(wal_path_, std::ios::app);
-        if (!wal_file_->is_open()) {
-            std::cerr << "Warning: Failed to open WAL file: " << wal_path_ << std::endl;
-            wal_file_.reset();
+        wal_file_ = WalWriter::open(wal_path_, options.wal_segment_size, wal_durability_, options.wal_direct_io);
+        if (!wal_file_) {
+            std::cerr << "Warning: Failed to open WAL file: " << wal_path_
+                      << " (a single-file log must keep the wal_direct_io setting it was written with)" << std::endl;
+        } else if (options.wal_direct_io && !wal_file_->direct_io()) {
+            std::cerr << "Warning: O_DIRECT unsupported for " << wal_path_
+                      << "; the WAL is written through the page cache" << std::endl;
         }
     }
 }
 
 KVStore::~KVStore() {
-    if (wal_file_ && wal_file_->is_open()) {
-        wal_file_->close();
+    namespaces_.clear();
+    
+    // An unfinished snapshot is abandoned; its temporary file is removed
+    snapshot_cancelled_ = true;
+    {
+        std::lock_guard<std::mutex> thread_lock(snapshot_thread_mutex_);
+        if (snapshot_thread_.joinable()) {
+            snapshot_thread_.join();
+        }
+    }
+    
+    // Finish this store's pending background tasks while the rest of it is still intact;
+    // the worker may be shared and outlive this store
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        background_idle_.wait(lock, [this] { return background_tasks_ == 0; });
     }
+    
+    // A large index is torn down on the worker, which is drained and joined once its last
+    // user lets go: here, or with the parent store when this is a namespace
+    if (background_ && cache_.size() >= kAsyncTeardownThreshold) {
+        auto tables = std::make_shared<DetachedTables>(arena_);
+        detach_tables(*tables);
+        background_->submit([tables]() mutable { tables.reset(); });
+    }
+    background_.reset();
+    
+    wal_file_.reset(); // Writes out any buffered records
 }
 
-bool KVStore::put(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool KVStore::put(const std::string& key, const std::string& value, const PutOptions& options) {
+    bool stored;
+    WalWriter* wal;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stored = put_locked(key, value, options);
+        wal = wal_file_.get();
+    }
+    commit_wal(wal);
+    return stored;
+}
+
+bool KVStore::put_locked(const std::string& key, const std::string& value, const PutOptions& options,
+                         bool durable) {
+    forget_absent(key);
+    hot_keys_.record(key);
+    if (durable && recovering_) {
+        recovery_pending_.erase(key); // This write supersedes the key's logged record
+    }
+    if (replicas_ && fingerprint_size_ == 0) {
+        replicas_->invalidate(key);
+    } else if (replicas_) {
+        replicas_->invalidate(replica_key(key));
+    }
     
-    auto it = cache_.find(key);
+    char fingerprint[kMaxFingerprintSize];
+    ArenaBuffer index = index_key(key, fingerprint);
+    auto it = cache_.find(index);
     
     if (it != cache_.end()) {
         // Key exists, update value and move to front
-        it->second.value = value;
-        lru_list_.erase(it->second.lru_iter);
-        lru_list_.push_front(key);
-        it->second.lru_iter = lru_list_.begin();
+        leave_cold_tier(it);
+        preserve_for_snapshot(it->second, it->first);
+        bytes_used_ -= entry_bytes(index.size(), stored_size(it->second));
+        release_value(it->second);
+        set_value(it->second, value.data(), value.size());
+        it->second.options = options;
+        it->second.refreshing = false;
+        bytes_used_ += entry_bytes(index.size(), stored_size(it->second));
+        touch(it);
     } else {
         // New key
-        if (cache_.size() >= max_capacity_) {
-            evict_lru();
+        lru_list_.push_front(nullptr);
+        it = cache_.emplace(ArenaBuffer(*arena_, index.data(), index.size()),
+                            CacheEntry{ArenaBuffer(), lru_list_.begin(), options, {}, false, 1,
+                                       priority_queue_.end(), false, false, 0, 0, snapshot_epoch_}).first;
+        lru_list_.front() = &it->first;
+        if (key_filter_) {
+            key_filter_->add(filter_hash(index));
+        }
+        set_value(it->second, value.data(), value.size());
+        bytes_used_ += entry_bytes(index.size(), stored_size(it->second));
+        if (eviction_policy_ == EvictionPolicy::GDSF) {
+            update_priority(it);
         }
-        
-        lru_list_.push_front(key);
-        cache_[key] = CacheEntry{value, lru_list_.begin()};
     }
     
-    write_wal("PUT", key, value);
-    return true;
+    if (options.soft_ttl.count() > 0 || options.hard_ttl.count() > 0) {
+        it->second.written_at = Clock::now();
+    }
+    if (shared_table_) {
+        shared_table_->put(key, value, options.hard_ttl);
+    }
+    bool persisted = true;
+    if (persistent_table_ && durable && !persistent_table_->put(key, value, options.hard_ttl)) {
+        persisted = false; // Too large, or no free slot in its probe window: memory only
+        persistent_write_failed(key, value);
+    }
+    
+    // Make room, never choosing the entry just written. With background eviction this
+    // is only the fallback for a blown hard budget; the reclaimer handles the watermarks.
+    while (over_budget() && evict(&it->first)) {
+    }
+    
+    if (background_eviction_ && !reclaim_scheduled_ && above_watermark(high_watermark_)) {
+        reclaim_scheduled_ = true;
+        submit_background([this] { reclaim(); });
+    }
+    if (compress_cold_) {
+        compress_cold();
+    }
+    maybe_defrag();
+    
+    const CacheEntry& entry = it->second;
+    if (!durable) {
+        return true;
+    }
+    if (entry.raw_size > 0 && wal_file_) {
+        // Log the compressed bytes already in hand rather than the raw value
+        write_wal("PUTZ", key, std::to_string(entry.dict_version) + " " + std::to_string(entry.raw_size) +
+                                   " " + base64_encode(entry.value.data(), entry.value.size()));
+    } else {
+        write_wal("PUT", key, value);
+    }
+    return persisted;
 }
 
 std::optional<std::string> KVStore::get(const std::string& key) {
+    if (auto replica = get_replica(key)) {
+        return replica;
+    }
+    if (filtered_out(key)) {
+        return std::nullopt;
+    }
+    
     std::lock_guard<std::mutex> lock(mutex_);
+    hot_keys_.record(key);
     
-    auto it = cache_.find(key);
+    auto it = find_live(key);
     if (it == cache_.end()) {
+        misses_++;
         return std::nullopt;
     }
     
-    // Move to front of LRU list
-    lru_list_.erase(it->second.lru_iter);
-    lru_list_.push_front(key);
-    it->second.lru_iter = lru_list_.begin();
+    hits_++;
+    touch(it);
+    maybe_refresh(it, key);
+    
+    if (replicas_ && ++ops_since_replica_refresh_ >= kReplicaRefreshInterval) {
+        refresh_replicas();
+    }
     
-    return it->second.value;
+    return value_of(it->second);
 }
 
-bool KVStore::del(const std::string& key) {
+std::optional<std::string> KVStore::get_or_load(const std::string& key, const Loader& loader,
+                                                const PutOptions& options) {
+    if (auto replica = get_replica(key)) {
+        return replica;
+    }
+    
+    std::promise<std::optional<std::string>> promise;
+    std::shared_future<std::optional<std::string>> pending;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hot_keys_.record(key);
+        
+        auto it = find_live(key);
+        if (it != cache_.end()) {
+            hits_++;
+            touch(it);
+            maybe_refresh(it, key);
+            return value_of(it->second);
+        }
+        
+        misses_++;
+        if (is_known_absent(key)) {
+            return std::nullopt;
+        }
+        
+        auto inflight = inflight_loads_.find(key);
+        if (inflight != inflight_loads_.end()) {
+            pending = inflight->second;
+        } else {
+            inflight_loads_.emplace(key, promise.get_future().share());
+        }
+    }
+    
+    // Another caller is already loading this key: wait for its result
+    if (pending.valid()) {
+        return pending.get();
+    }
+    
+    // This caller is the leader: run the loader without holding the lock
+    std::optional<std::string> value;
+    try {
+        value = loader(key);
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            inflight_loads_.erase(key);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    
+    WalWriter* wal;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (value) {
+            put_locked(key, *value, options);
+        } else if (lookup(key) == cache_.end()) {
+            remember_absent(key);
+        }
+        inflight_loads_.erase(key);
+        wal = value ? wal_file_.get() : nullptr;
+    }
+    commit_wal(wal);
+    promise.set_value(value);
+    
+    return value;
+}
+
+void KVStore::set_refresher(Loader refresher) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    refresher_ = std::move(refresher);
+}
+
+void KVStore::set_negative_cache(size_t capacity, std::chrono::milliseconds ttl) {
     std::lock_guard<std::mutex> lock(mutex_);
+    negative_capacity_ = capacity;
+    negative_ttl_ = ttl;
     
-    auto it = cache_.find(key);
-    if (it == cache_.end()) {
+    while (negative_cache_.size() > negative_capacity_) {
+        negative_cache_.erase(negative_order_.back());
+        negative_order_.pop_back();
+    }
+}
+
+bool KVStore::del(const std::string& key) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (recovering_) {
+        replay_pending(key);
+    }
+    
+    auto it = lookup(key);
+    bool persisted = persistent_table_ && persistent_table_->erase(key);
+    if (it == cache_.end() && !persisted) {
         return false;
     }
     
-    lru_list_.erase(it->second.lru_iter);
-    cache_.erase(it);
+    if (it != cache_.end()) {
+        erase_entry(it);
+        maybe_defrag();
+    }
     
     write_wal("DEL", key);
+    WalWriter* wal = wal_file_.get();
+    lock.unlock();
+    commit_wal(wal);
     return true;
 }
 
 bool KVStore::exists(const std::string& key) const {
+    if (filtered_out(key)) {
+        return false;
+    }
+    
     std::lock_guard<std::mutex> lock(mutex_);
-    return cache_.find(key) != cache_.end();
+    if (recovering_) {
+        auto pending = recovery_pending_.find(key);
+        if (pending != recovery_pending_.end()) {
+            return !pending->second.deleted;
+        }
+    }
+    
+    auto it = lookup(key);
+    if (it == cache_.end()) {
+        return persistent_table_ && persistent_table_->get(key).has_value();
+    }
+    return !it->second.has_ttl() || !it->second.is_expired(Clock::now());
 }
 
 size_t KVStore::size() const {
@@ -87,11 +534,113 @@ size_t KVStore::size() const {
     return cache_.size();
 }
 
-void KVStore::clear() {
+size_t KVStore::memory_usage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_used_;
+}
+
+StoreStats KVStore::stats(size_t top_k) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    StoreStats stats;
+    stats.entries = cache_.size();
+    stats.bytes = bytes_used_;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    stats.replica_hits = replica_hits_.load(std::memory_order_relaxed);
+    stats.hits += stats.replica_hits;
+    stats.filtered_misses = filtered_misses_.load(std::memory_order_relaxed);
+    stats.shared_memory_entries = shared_table_ ? shared_table_->size() : 0;
+    stats.persistent_entries = persistent_table_ ? persistent_table_->size() : 0;
+    stats.persistent_faults = persistent_faults_;
+    stats.persistent_write_failures = persistent_write_failures_;
+    stats.wal_failed = wal_file_ && wal_file_->failed();
+    stats.recovery_pending_keys = recovery_pending_.size();
+    stats.snapshot_cow_copies = snapshot_cow_copies_;
+    stats.misses += stats.filtered_misses;
+    stats.arena_allocated_bytes = arena_->allocated_bytes();
+    stats.arena_mapped_bytes = arena_->mapped_bytes();
+    stats.defrag_moves = defrag_moves_;
+    stats.cold_entries = cold_entries_;
+    stats.cold_bytes_saved = cold_bytes_saved_;
+    stats.compressed_bytes_saved = compressed_bytes_saved_;
+    stats.dictionary_version = dictionary_version_;
+    stats.shared_values = value_pool_.size();
+    stats.dedup_bytes_saved = dedup_bytes_saved_;
+    stats.hot_keys = hot_keys_.top(top_k);
+    return stats;
+}
+
+uint32_t KVStore::train_dictionary(size_t max_size) {
+    std::vector<std::string> samples;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto key = lru_list_.begin(); key != lru_list_.end() && samples.size() < kDictionarySamples; ++key) {
+            samples.push_back(value_of(cache_.find(**key)->second));
+        }
+    }
+    
+    std::string content = lz4::train_dictionary(samples, max_size);
+    if (content.empty()) {
+        return 0;
+    }
+    
     std::lock_guard<std::mutex> lock(mutex_);
-    cache_.clear();
-    lru_list_.clear();
+    uint32_t version = dictionary_version_ + 1;
+    write_wal("DICT", std::to_string(version), base64_encode(content.data(), content.size()));
+    install_dictionary(version, std::move(content));
+    return version;
+}
+
+void KVStore::install_dictionary(uint32_t version, std::string content) {
+    uint32_t previous = dictionary_version_;
+    dictionaries_[version] = DictionarySlot{std::make_shared<const lz4::Dictionary>(std::move(content)), 0};
+    dictionary_version_ = version;
+    if (snapshot_) {
+        // The cold tier may recompress unsaved entries against it before the scan reaches them
+        snapshot_->copied += dictionary_record(version, dictionaries_[version].dictionary->content());
+    }
+    
+    auto old = dictionaries_.find(previous);
+    if (old != dictionaries_.end() && old->second.entries == 0) {
+        dictionaries_.erase(old);
+    }
+    relog_dictionaries();
+}
+
+void KVStore::relog_dictionaries() {
+    if (!wal_file_) {
+        return;
+    }
+    std::vector<std::string> records;
+    for (const auto& dict : dictionaries_) {
+        records.push_back(dictionary_record(dict.first, dict.second.dictionary->content()));
+    }
+    wal_file_->set_segment_header(std::move(records));
+}
+
+void KVStore::clear() {
+    // Declared before the lock so small tables are destroyed after it is released
+    auto tables = std::make_shared<DetachedTables>(arena_);
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    detach_tables(*tables);
+    if (persistent_table_) {
+        persistent_table_->clear();
+    }
+    recovery_pending_.clear(); // Nothing logged before this is replayed any more
+    negative_cache_.clear();
+    negative_order_.clear();
     write_wal("CLEAR", "");
+    WalWriter* wal = wal_file_.get();
+    
+    if (!keep_for_snapshot(tables) && tables->cache.size() >= kAsyncTeardownThreshold) {
+        background().submit([tables]() mutable { tables.reset(); });
+        tables.reset();
+    }
+    lock.unlock();
+    commit_wal(wal);
 }
 
 bool KVStore::recover() {
@@ -99,81 +648,1254 @@ bool KVStore::recover() {
         return false;
     }
     
-    std::ifstream wal_in(wal_path_);
-    if (!wal_in.is_open()) {
-        return false;
-    }
-    
+    return replay(WalWriter::files(wal_path_));
+}
+
+bool KVStore::load_snapshot(const std::string& path) {
+    return replay({path});
+}
+
+bool KVStore::replay(const std::vector<std::string>& paths) {
     // Temporarily disable WAL during recovery to avoid duplicate writes
     auto temp_wal = std::move(wal_file_);
     
-    std::string line;
-    while (std::getline(wal_in, line)) {
-        std::istringstream iss(line);
-        std::string op, key, value;
-        
-        if (!(iss >> op)) {
-            continue;
+    // Dictionaries by the version numbers the log uses, for decoding PUTZ records, and a
+    // snapshot's shared values by id, for decoding PUTS records
+    std::unordered_map<uint32_t, std::shared_ptr<const lz4::Dictionary>> replayed;
+    std::unordered_map<uint64_t, std::string> shared;
+    {
+        // A log whose early segments a checkpoint recycled relies on those the snapshot installed
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& dict : dictionaries_) {
+            replayed.emplace(dict.first, dict.second.dictionary);
         }
-        
-        if (op == "PUT") {
-            if (!(iss >> key)) {
+    }
+    
+    size_t opened = 0;
+    std::string line;
+    for (const std::string& path : paths) {
+        WalReader in(path);
+        opened += in.is_open() ? 1 : 0;
+        while (in.next(line)) {
+            std::istringstream iss(line);
+            std::string op, key, value;
+            
+            if (!(iss >> op)) {
                 continue;
             }
-            std::getline(iss, value);
-            if (!value.empty() && value[0] == ' ') {
-                value = value.substr(1); // Remove leading space
+            
+            if (op == "PUT" || op == "PUTZ" || op == "PUTS") {
+                auto lookup_replayed = [&replayed](uint32_t version) -> const lz4::Dictionary* {
+                    auto dict = replayed.find(version);
+                    return dict == replayed.end() ? nullptr : dict->second.get();
+                };
+                if (decode_put(line, key, value, lookup_replayed, &shared)) {
+                    put(key, value);
+                }
+            } else if (op == "SHARED") {
+                uint64_t id;
+                std::string payload;
+                if (!(iss >> id >> payload) || !base64_decode(payload, shared[id])) {
+                    shared.erase(id);
+                }
+            } else if (op == "DICT") {
+                uint32_t version;
+                std::string payload, content;
+                if (!(iss >> version >> payload) || !base64_decode(payload, content)) {
+                    continue;
+                }
+                replayed[version] = std::make_shared<const lz4::Dictionary>(content);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (version > dictionary_version_) {
+                    install_dictionary(version, std::move(content));
+                }
+            } else if (op == "DEL") {
+                if (!(iss >> key)) {
+                    continue;
+                }
+                del(key);
+            } else if (op == "CLEAR") {
+                clear();
             }
-            put(key, value);
-        } else if (op == "DEL") {
-            if (!(iss >> key)) {
+        }
+    }
+    
+    // Re-enable WAL
+    std::lock_guard<std::mutex> lock(mutex_);
+    wal_file_ = std::move(temp_wal);
+    relog_dictionaries();
+    
+    return opened > 0;
+}
+
+bool KVStore::recover_async() {
+    if (wal_path_.empty()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (recovering_) {
+            return false;
+        }
+        recovering_ = true; // Claimed for the index pass, which runs without the lock
+    }
+    
+    // Index pass: only the offset of each key's last record is kept, so no value is decoded
+    // and the keys are served as soon as it ends. It builds everything locally so reads are
+    // not held up while it scans the log
+    std::unordered_map<std::string, PendingRecord> pending;
+    std::unordered_map<uint32_t, std::map<uint64_t, std::shared_ptr<const lz4::Dictionary>>> dictionaries;
+    std::vector<std::pair<uint64_t, std::string>> files;
+    uint32_t latest_version = 0;
+    std::string latest_dictionary;
+    bool saw_clear = false;
+    uint64_t offset = 0;
+    std::string line;
+    for (const std::string& path : WalWriter::files(wal_path_)) {
+        WalReader wal_in(path);
+        uint64_t start = offset;
+        files.emplace_back(start, path);
+        for (uint64_t record = start; wal_in.next(line); record = offset) {
+            offset = start + wal_in.position();
+            
+            std::istringstream iss(line);
+            std::string op, key;
+            if (!(iss >> op)) {
                 continue;
             }
-            del(key);
-        } else if (op == "CLEAR") {
-            clear();
+            
+            if ((op == "PUT" || op == "PUTZ" || op == "DEL") && (iss >> key)) {
+                pending[key] = PendingRecord{record, op == "DEL"};
+            } else if (op == "DICT") {
+                uint32_t version;
+                std::string payload, content;
+                if (!(iss >> version >> payload) || !base64_decode(payload, content)) {
+                    continue;
+                }
+                dictionaries[version][record] = std::make_shared<const lz4::Dictionary>(content);
+                if (version >= latest_version) { // The last one logged, should the version repeat
+                    latest_version = version;
+                    latest_dictionary = std::move(content);
+                }
+            } else if (op == "CLEAR") {
+                pending.clear();
+                saw_clear = true;
+            }
         }
     }
     
-    wal_in.close();
+    // Declared before the lock so a CLEAR record's tables are destroyed after it is released
+    auto cleared = std::make_shared<DetachedTables>(arena_);
     
-    // Re-enable WAL
-    wal_file_ = std::move(temp_wal);
+    // Installed in one step, so a request sees either none of the index or all of it
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (files.empty()) {
+        recovering_ = false;
+        return false;
+    }
+    if (latest_version > dictionary_version_) {
+        install_dictionary(latest_version, std::move(latest_dictionary));
+    }
+    if (saw_clear) {
+        detach_tables(*cleared);
+        keep_for_snapshot(cleared);
+        if (persistent_table_) {
+            persistent_table_->clear();
+        }
+    }
+    if (pending.empty()) {
+        recovering_ = false;
+        return true;
+    }
     
+    for (const auto& dict : dictionaries_) {
+        // In effect from the start of the log, unless its first record is a DICT of that version
+        dictionaries[dict.first].emplace(0, dict.second.dictionary);
+    }
+    recovery_pending_ = std::move(pending);
+    recovery_dictionaries_ = std::move(dictionaries);
+    recovery_files_ = std::move(files);
+    recovery_file_ = recovery_files_.size(); // None open yet
+    recovery_offset_ = 0;
+    recovery_end_ = offset;
+    submit_background([this] { replay_log(); });
     return true;
 }
 
-void KVStore::touch(const std::string& key) {
-    // Note: This method must be called while mutex_ is already held
-    auto it = cache_.find(key);
-    if (it != cache_.end()) {
-        lru_list_.erase(it->second.lru_iter);
-        lru_list_.push_front(key);
-        it->second.lru_iter = lru_list_.begin();
+bool KVStore::recovering() const {
+    return recovering_.load(std::memory_order_acquire);
+}
+
+std::future<bool> KVStore::snapshot(const std::string& path, size_t max_bytes_per_second) {
+    return start_snapshot(path, max_bytes_per_second, false);
+}
+
+std::future<bool> KVStore::checkpoint(const std::string& path, size_t max_bytes_per_second) {
+    return start_snapshot(path, max_bytes_per_second, true);
+}
+
+std::future<bool> KVStore::start_snapshot(const std::string& path, size_t max_bytes_per_second, bool checkpoint) {
+    std::promise<bool> done;
+    std::future<bool> result = done.get_future();
+    if (fingerprint_size_ > 0) {
+        std::cerr << "Warning: fingerprint_keys does not keep keys; snapshot not written" << std::endl;
+        done.set_value(false);
+        return result;
+    }
+    if (persistent_table_) {
+        std::cerr << "Warning: entries kept only in the persistent file would be missing; snapshot not written"
+                  << std::endl;
+        done.set_value(false);
+        return result;
+    }
+    if (snapshotting_.exchange(true)) {
+        done.set_value(false);
+        return result;
+    }
+    
+    // The previous worker may have finished before its starter had assigned snapshot_thread_
+    std::lock_guard<std::mutex> thread_lock(snapshot_thread_mutex_);
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join(); // The previous snapshot has finished
+    }
+    
+    // The segments before first_kept hold only records the image covers
+    WalWriter* wal = nullptr;
+    uint64_t first_kept = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (checkpoint && wal_file_) {
+            wal = wal_file_.get();
+            first_kept = wal->roll();
+        }
+        
+        // Every entry written before this point has a lower epoch and belongs to the image
+        snapshot_ = std::make_unique<SnapshotState>();
+        snapshot_->epoch = ++snapshot_epoch_;
+        snapshot_->bucket_count = cache_.bucket_count();
+        for (const auto& dict : dictionaries_) {
+            snapshot_->copied += dictionary_record(dict.first, dict.second.dictionary->content());
+        }
     }
+    
+    snapshot_thread_ = std::thread([this, path, max_bytes_per_second, wal, first_kept,
+                                    done = std::move(done)]() mutable {
+        bool written = false;
+        try {
+            written = stream_snapshot(path, max_bytes_per_second);
+            if (written && first_kept > 0) {
+                wal->recycle(first_kept);
+            }
+        } catch (...) {
+            // Reported as a failed snapshot below
+        }
+        // Cleared first, so a caller that has seen the result can start the next snapshot
+        snapshotting_ = false;
+        done.set_value(written);
+    });
+    return result;
 }
 
-void KVStore::evict_lru() {
-    if (lru_list_.empty()) {
-        return;
+bool KVStore::stream_snapshot(const std::string& path, size_t max_bytes_per_second) {
+    const std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    auto start = Clock::now();
+    uint64_t written = 0;
+    std::string chunk;
+    
+    // Write a chunk outside mutex_, then sleep off any lead over the rate limit
+    auto flush = [&]() {
+        out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        written += chunk.size();
+        chunk.clear();
+        if (max_bytes_per_second == 0) {
+            return;
+        }
+        auto due = start + std::chrono::nanoseconds(written * 1000000000ull / max_bytes_per_second);
+        while (!snapshot_cancelled_ && Clock::now() < due) {
+            std::this_thread::sleep_for(std::min<Clock::duration>(due - Clock::now(), kSnapshotThrottleStep));
+        }
+    };
+    
+    // Entries still unsaved when clear() swapped them out, saved without the lock, and the
+    // shared values already written that they may refer to
+    std::vector<std::shared_ptr<DetachedTables>> detached;
+    SharedValueIds shared;
+    uint64_t epoch = 0;
+    bool scanned = false;
+    while (!scanned && !snapshot_cancelled_ && out) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            SnapshotState& state = *snapshot_;
+            epoch = state.epoch;
+            chunk.swap(state.copied);
+            
+            // A rehash reorders the buckets; rescanning is safe as saved entries are skipped
+            if (cache_.bucket_count() != state.bucket_count) {
+                state.bucket_count = cache_.bucket_count();
+                state.cursor = 0;
+            }
+            auto now = Clock::now();
+            for (; state.cursor < state.bucket_count && chunk.size() < kSnapshotChunk; ++state.cursor) {
+                for (auto it = cache_.begin(state.cursor); it != cache_.end(state.cursor); ++it) {
+                    if (it->second.snapshot_epoch < epoch) {
+                        if (!it->second.is_expired(now)) {
+                            chunk += snapshot_record(it->first, it->second, state.shared);
+                        }
+                        it->second.snapshot_epoch = epoch;
+                    }
+                }
+            }
+            
+            if (state.cursor >= state.bucket_count) {
+                scanned = true;
+                chunk += state.copied;
+                detached = std::move(state.detached);
+                shared = std::move(state.shared);
+                snapshot_.reset(); // Writers stop copying from here on
+            }
+        }
+        flush();
+    }
+    
+    for (const auto& tables : detached) {
+        auto now = Clock::now();
+        for (auto it = tables->cache.begin(); it != tables->cache.end() && !snapshot_cancelled_; ++it) {
+            if (it->second.snapshot_epoch < epoch && !it->second.is_expired(now)) {
+                chunk += snapshot_record(it->first, it->second, shared);
+                if (chunk.size() >= kSnapshotChunk) {
+                    flush();
+                }
+            }
+        }
     }
+    flush();
     
-    const std::string& lru_key = lru_list_.back();
-    cache_.erase(lru_key);
-    lru_list_.pop_back();
+    if (!scanned) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshot_.reset();
+    }
+    out.close();
+    if (!scanned || snapshot_cancelled_ || !out || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
 }
 
-void KVStore::write_wal(const std::string& operation, const std::string& key, const std::string& value) {
-    if (!wal_file_ || !wal_file_->is_open()) {
+std::string KVStore::snapshot_record(const ArenaBuffer& key, const CacheEntry& entry,
+                                     SharedValueIds& shared) const {
+    if (entry.shared) {
+        // A pooled value is written once, ahead of the first entry referring to it
+        std::string record;
+        auto id = shared.ids.find(entry.value.data());
+        if (id == shared.ids.end()) {
+            id = shared.ids.emplace(entry.value.data(), shared.next++).first;
+            record = "SHARED " + std::to_string(id->second) + " " +
+                     base64_encode(entry.value.data(), entry.value.size()) + "\n";
+        }
+        return record + "PUTS " + key.str() + " " + std::to_string(id->second) + " " +
+               std::to_string(entry.dict_version) + " " + std::to_string(entry.raw_size) + "\n";
+    }
+    if (entry.raw_size > 0) {
+        return "PUTZ " + key.str() + " " + std::to_string(entry.dict_version) + " " +
+               std::to_string(entry.raw_size) + " " + base64_encode(entry.value.data(), entry.value.size()) + "\n";
+    }
+    return "PUT " + key.str() + " " + entry.value.str() + "\n";
+}
+
+void KVStore::preserve_for_snapshot(CacheEntry& entry, const ArenaBuffer& key) {
+    if (!snapshot_ || entry.snapshot_epoch >= snapshot_->epoch) {
         return;
     }
+    if (!entry.is_expired(Clock::now())) {
+        snapshot_->copied += snapshot_record(key, entry, snapshot_->shared);
+        snapshot_cow_copies_++;
+    }
+    entry.snapshot_epoch = snapshot_->epoch;
+}
+
+bool KVStore::keep_for_snapshot(std::shared_ptr<DetachedTables>& tables) {
+    if (!snapshot_) {
+        return false;
+    }
+    snapshot_->detached.push_back(std::move(tables));
+    return true;
+}
+
+void KVStore::replay_log() {
+    std::string line;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            bool readable = true;
+            uint64_t next = 0;
+            for (size_t n = 0; n < kRecoveryBatch && !recovery_pending_.empty() && recovery_offset_ < recovery_end_ &&
+                               (readable = read_recovery_record(recovery_offset_, line, next)); ++n) {
+                uint64_t record = recovery_offset_;
+                recovery_offset_ = next;
+                
+                // Only a key's last record counts; earlier ones are superseded
+                std::istringstream iss(line);
+                std::string op, key;
+                if (!(iss >> op >> key)) {
+                    continue;
+                }
+                auto pending = recovery_pending_.find(key);
+                if (pending != recovery_pending_.end() && pending->second.offset == record) {
+                    apply_record(line, record);
+                }
+            }
+            
+            if (recovery_pending_.empty() || recovery_offset_ >= recovery_end_ || !readable) {
+                recovery_pending_.clear();
+                recovery_dictionaries_.clear();
+                recovery_files_.clear();
+                recovery_reader_.reset();
+                recovering_ = false;
+                return;
+            }
+        }
+        // Lock released between slices so requests interleave with the replay
+    }
+}
+
+bool KVStore::read_recovery_record(uint64_t offset, std::string& line, uint64_t& next) {
+    // The last file starting at or before the offset; an empty file shares its start with the next
+    auto file = std::upper_bound(recovery_files_.begin(), recovery_files_.end(), offset,
+                                 [](uint64_t value, const auto& start) { return value < start.first; });
+    if (file == recovery_files_.begin()) {
+        return false;
+    }
+    size_t index = std::prev(file) - recovery_files_.begin();
+    
+    // Sequential reads continue where the reader is; requests replaying single records seek
+    uint64_t start = recovery_files_[index].first;
+    if (index != recovery_file_ || !recovery_reader_) {
+        recovery_reader_ = std::make_unique<WalReader>(recovery_files_[index].second);
+        recovery_file_ = index;
+    }
+    if (recovery_reader_->position() != offset - start) {
+        recovery_reader_->seek(offset - start);
+    }
+    if (!recovery_reader_->next(line)) {
+        return false;
+    }
+    next = start + recovery_reader_->position();
+    return true;
+}
+
+KVStore* KVStore::create_namespace(const std::string& name, const StoreOptions& options) {
+    // Namespaces on this store's NUMA node share its worker, and its arena too when they
+    // ask for the same page backing; others get their own
+    std::shared_ptr<BackgroundWorker> shared_background;
+    std::shared_ptr<Arena> shared_arena;
+    if (options.numa_node == numa_node_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        background();
+        shared_background = background_;
+        if (options.huge_pages == arena_->huge_pages()) {
+            shared_arena = arena_;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(namespaces_mutex_);
+    if (namespaces_.count(name) > 0) {
+        return nullptr;
+    }
+    
+    std::unique_ptr<KVStore> store(new KVStore(options, std::move(shared_background), std::move(shared_arena)));
+    KVStore* raw = store.get();
+    namespaces_.emplace(name, std::move(store));
+    return raw;
+}
+
+KVStore* KVStore::find_namespace(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(namespaces_mutex_);
+    auto it = namespaces_.find(name);
+    return it == namespaces_.end() ? nullptr : it->second.get();
+}
+
+bool KVStore::drop_namespace(const std::string& name) {
+    std::unique_ptr<KVStore> dropped;
+    {
+        std::lock_guard<std::mutex> lock(namespaces_mutex_);
+        auto it = namespaces_.find(name);
+        if (it == namespaces_.end()) {
+            return false;
+        }
+        dropped = std::move(it->second);
+        namespaces_.erase(it);
+    }
+    // Destroyed here, outside namespaces_mutex_
+    return true;
+}
+
+std::vector<std::string> KVStore::namespace_names() const {
+    std::lock_guard<std::mutex> lock(namespaces_mutex_);
+    std::vector<std::string> names;
+    names.reserve(namespaces_.size());
+    for (const auto& entry : namespaces_) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+KVStore::CacheMap::iterator KVStore::find_live(const std::string& key) {
+    if (recovering_) {
+        replay_pending(key);
+    }
+    auto it = lookup(key);
+    if (it == cache_.end() && persistent_table_) {
+        return fault_in(key);
+    }
+    if (it == cache_.end() || !it->second.has_ttl()) {
+        return it;
+    }
+    
+    if (it->second.is_expired(Clock::now())) {
+        erase_entry(it);
+        return cache_.end();
+    }
+    return it;
+}
+
+KVStore::CacheMap::iterator KVStore::fault_in(const std::string& key) {
+    std::chrono::nanoseconds ttl{0};
+    auto value = persistent_table_->get(key, &ttl);
+    if (!value) {
+        return cache_.end();
+    }
+    
+    // The file keeps the hard deadline; the soft TTL and GDSF cost are not persisted
+    PutOptions options;
+    if (ttl.count() > 0) {
+        options.hard_ttl = std::chrono::ceil<std::chrono::milliseconds>(ttl);
+    }
+    put_locked(key, *value, options, false);
+    persistent_faults_++;
+    return lookup(key);
+}
+
+void KVStore::replay_pending(const std::string& key) {
+    auto pending = recovery_pending_.find(key);
+    if (pending == recovery_pending_.end()) {
+        return;
+    }
+    
+    std::string line;
+    uint64_t next;
+    if (read_recovery_record(pending->second.offset, line, next)) {
+        apply_record(line, pending->second.offset);
+    }
+    recovery_pending_.erase(key); // Even if unreadable, so it is not retried
+}
+
+void KVStore::apply_record(const std::string& line, uint64_t offset) {
+    // A version number may be reused in one log (a store reopened without recovering and
+    // retrained), so the dictionary is the last one logged for it before this record
+    auto lookup_recovery = [this, offset](uint32_t version) -> const lz4::Dictionary* {
+        auto by_offset = recovery_dictionaries_.find(version);
+        if (by_offset == recovery_dictionaries_.end()) {
+            return nullptr;
+        }
+        auto dict = by_offset->second.upper_bound(offset);
+        return dict == by_offset->second.begin() ? nullptr : std::prev(dict)->second.get();
+    };
+
+    std::string key, value;
+    if (line.compare(0, 4, "DEL ") == 0) {
+        key = line.substr(4);
+        auto it = lookup(key);
+        if (it != cache_.end()) {
+            erase_entry(it);
+        }
+        if (persistent_table_) {
+            persistent_table_->erase(key);
+        }
+    } else if (decode_put(line, key, value, lookup_recovery)) {
+        // Already in the log, so only the mapped file (if any) needs the write
+        put_locked(key, value, PutOptions(), false);
+        if (persistent_table_ && !persistent_table_->put(key, value)) {
+            persistent_write_failed(key, value);
+        }
+    }
+    recovery_pending_.erase(key);
+}
+
+void KVStore::persistent_write_failed(const std::string& key, const std::string& value) {
+    if (persistent_write_failures_++ > 0) {
+        return;
+    }
+    // Only the first is reported; stats().persistent_write_failures counts the rest
+    if (key.size() + value.size() > persistent_table_->max_record_size()) {
+        std::cerr << "Warning: entries over " << persistent_table_->max_record_size()
+                  << " bytes (key plus value) do not fit persistent_slot_size and are kept in memory only"
+                  << std::endl;
+    } else {
+        std::cerr << "Warning: the persistent file has no free slot near a key's hash; "
+                  << "the entry is kept in memory only (raise persistent_slots)" << std::endl;
+    }
+}
+
+bool KVStore::is_known_absent(const std::string& key) {
+    if (negative_cache_.empty()) {
+        return false;
+    }
+    
+    auto it = negative_cache_.find(hash64(key.data(), key.size(), kNegativeSeed));
+    if (it == negative_cache_.end()) {
+        return false;
+    }
+    
+    if (Clock::now() >= it->second.expires_at) {
+        negative_order_.erase(it->second.order_iter);
+        negative_cache_.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void KVStore::remember_absent(const std::string& key) {
+    if (negative_capacity_ == 0) {
+        return;
+    }
+    
+    forget_absent(key);
+    if (negative_cache_.size() >= negative_capacity_) {
+        negative_cache_.erase(negative_order_.back());
+        negative_order_.pop_back();
+    }
+    
+    uint64_t hash = hash64(key.data(), key.size(), kNegativeSeed);
+    negative_order_.push_front(hash);
+    negative_cache_.emplace(hash, NegativeEntry{Clock::now() + negative_ttl_, negative_order_.begin()});
+}
+
+void KVStore::forget_absent(const std::string& key) {
+    if (negative_cache_.empty()) {
+        return;
+    }
+    
+    auto it = negative_cache_.find(hash64(key.data(), key.size(), kNegativeSeed));
+    if (it != negative_cache_.end()) {
+        negative_order_.erase(it->second.order_iter);
+        negative_cache_.erase(it);
+    }
+}
+
+void KVStore::touch(CacheMap::iterator it) {
+    // Note: This method must be called while mutex_ is already held
+    if (it->second.cold) {
+        promote(it);
+    }
+    lru_list_.splice(lru_list_.begin(), lru_list_, it->second.lru_iter);
+    
+    if (eviction_policy_ == EvictionPolicy::GDSF) {
+        it->second.frequency++;
+        update_priority(it);
+    }
+}
+
+void KVStore::maybe_refresh(CacheMap::iterator it, const std::string& key) {
+    CacheEntry& entry = it->second;
+    if (!refresher_ || entry.refreshing || !entry.has_ttl() || !entry.is_stale(Clock::now())) {
+        return;
+    }
+    
+    entry.refreshing = true;
+    submit_background([this, key] { refresh(key); });
+}
+
+void KVStore::refresh(const std::string& key) {
+    Loader refresher;
+    Clock::time_point written_at;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = lookup(key);
+        if (it == cache_.end() || !it->second.refreshing) {
+            return;
+        }
+        refresher = refresher_;
+        written_at = it->second.written_at;
+    }
+    
+    std::optional<std::string> value;
+    if (refresher) {
+        try {
+            value = refresher(key);
+        } catch (...) {
+            // Keep serving the stale value; a later get() retries the refresh
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = lookup(key);
+    if (it == cache_.end() || !it->second.refreshing || it->second.written_at != written_at) {
+        return; // Deleted, evicted or overwritten while the refresh was running
+    }
+    
+    it->second.refreshing = false;
+    if (value) {
+        put_locked(key, *value, it->second.options);
+    }
+}
+
+std::optional<std::string> KVStore::get_replica(const std::string& key) {
+    // Hot keys are served from this core's replica without taking mutex_
+    if (!replicas_ || replicas_->empty()) {
+        return std::nullopt;
+    }
+    
+    auto replica = fingerprint_size_ == 0 ? replicas_->get(key) : replicas_->get(replica_key(key));
+    if (replica) {
+        replica_hits_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return replica;
+}
+
+void KVStore::refresh_replicas() {
+    ops_since_replica_refresh_ = 0;
+    
+    // Replica reads bypass the tracker: credit them to their keys before picking again
+    for (const auto& hit : replicas_->take_hits()) {
+        auto source = replica_sources_.find(hit.first);
+        if (source != replica_sources_.end()) {
+            hot_keys_.add(source->second, hit.second);
+        }
+    }
+    
+    std::unordered_set<std::string> wanted;
+    replica_sources_.clear();
+    for (const HotKey& hot : hot_keys_.top(replicated_hot_keys_)) {
+        std::string replicated = replica_key(hot.key);
+        replica_sources_.emplace(replicated, hot.key);
+        wanted.insert(std::move(replicated));
+    }
+    
+    // Age the counts so a key that cools off falls behind the keys read now
+    hot_keys_.decay();
+    
+    // Drop keys that cooled down
+    std::vector<std::string> cooled;
+    for (const std::string& key : replicas_->keys()) {
+        if (wanted.count(key) == 0) {
+            cooled.push_back(key);
+        }
+    }
+    for (const std::string& key : cooled) {
+        replicas_->invalidate(key);
+    }
+    
+    for (const std::string& key : wanted) {
+        auto it = cache_.find(ArenaBuffer::borrow(key.data(), key.size()));
+        if (it == cache_.end() || it->second.has_ttl()) {
+            continue; // Absent, or needs expiry/refresh checks only the locked path performs
+        }
+        
+        // Replica reads bypass touch(), so keep replicated keys away from the eviction end here
+        touch(it);
+        if (!replicas_->contains(key)) {
+            replicas_->install(key, value_of(it->second));
+        }
+    }
+}
+
+void KVStore::fingerprint(const std::string& key, char* out) const {
+    uint64_t fingerprint = hash64(key.data(), key.size(), kFingerprintSeed);
+    std::memcpy(out, &fingerprint, sizeof(fingerprint));
+    if (fingerprint_size_ > sizeof(fingerprint)) {
+        uint32_t checksum = static_cast<uint32_t>(hash64(key.data(), key.size(), kChecksumSeed));
+        std::memcpy(out + sizeof(fingerprint), &checksum, sizeof(checksum));
+    }
+}
+
+uint64_t KVStore::filter_hash(const ArenaBuffer& index) {
+    return hash64(index.data(), index.size(), kFilterSeed);
+}
+
+bool KVStore::filtered_out(const std::string& key) const {
+    // Keys not yet replayed are not in the filter
+    if (!key_filter_ || recovering_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    char fingerprint[kMaxFingerprintSize];
+    if (key_filter_->may_contain(filter_hash(index_key(key, fingerprint)))) {
+        return false;
+    }
+    filtered_misses_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::string KVStore::replica_key(const std::string& key) const {
+    char fingerprint[kMaxFingerprintSize];
+    return index_key(key, fingerprint).str();
+}
+
+size_t KVStore::entry_bytes(size_t key_size, size_t value_size) {
+    return key_size + value_size + kEntryOverhead;
+}
+
+size_t KVStore::stored_size(const CacheEntry& entry) {
+    return entry.shared ? 0 : entry.value.size();
+}
+
+void KVStore::update_priority(CacheMap::iterator it) {
+    CacheEntry& entry = it->second;
+    if (entry.priority_iter != priority_queue_.end()) {
+        priority_queue_.erase(entry.priority_iter);
+    }
+    
+    // H = L + frequency * cost / size: cheap-to-refetch, large, rarely used entries go first
+    double size = static_cast<double>(entry_bytes(it->first.size(), entry.value.size()));
+    double priority = gdsf_clock_ + entry.frequency * entry.options.cost / size;
+    entry.priority_iter = priority_queue_.emplace(priority, &it->first);
+}
+
+void KVStore::erase_entry(CacheMap::iterator it) {
+    preserve_for_snapshot(it->second, it->first);
+    if (replicas_) {
+        replicas_->invalidate(it->first.str());
+    }
+    leave_cold_tier(it);
+    if (key_filter_) {
+        key_filter_->remove(filter_hash(it->first));
+    }
+    if (shared_table_) {
+        shared_table_->erase(it->first.view());
+    }
+    bytes_used_ -= entry_bytes(it->first.size(), stored_size(it->second));
+    lru_list_.erase(it->second.lru_iter);
+    if (eviction_policy_ == EvictionPolicy::GDSF) {
+        priority_queue_.erase(it->second.priority_iter);
+    }
+    release_value(it->second);
+    cache_.erase(it);
+}
+
+bool KVStore::over_budget() const {
+    return cache_.size() > max_capacity_ || (max_bytes_ > 0 && bytes_used_ > max_bytes_);
+}
+
+bool KVStore::evict(const ArenaBuffer* protect) {
+    if (eviction_policy_ == EvictionPolicy::GDSF) {
+        for (auto victim = priority_queue_.begin(); victim != priority_queue_.end(); ++victim) {
+            if (victim->second == protect) {
+                continue;
+            }
+            // Age the remaining entries by raising the clock to the evicted priority
+            gdsf_clock_ = victim->first;
+            erase_entry(cache_.find(*victim->second));
+            evictions_++;
+            return true;
+        }
+        return false;
+    }
+    
+    if (lru_list_.empty()) {
+        return false;
+    }
+    
+    if (lru_list_.back() == protect) {
+        return false;
+    }
+    auto victim = cache_.find(*lru_list_.back());
+    erase_entry(victim);
+    evictions_++;
+    return true;
+}
+
+bool KVStore::above_watermark(double fraction) const {
+    return cache_.size() > max_capacity_ * fraction ||
+           (max_bytes_ > 0 && bytes_used_ > max_bytes_ * fraction);
+}
+
+void KVStore::reclaim() {
+    while (true) {
+        std::vector<ArenaBuffer> frees;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < kReclaimBatch && above_watermark(low_watermark_); ++i) {
+                if (!evict(nullptr)) {
+                    break;
+                }
+            }
+            
+            // Take over queued large values so they are freed below, outside the lock
+            frees.swap(pending_frees_);
+            
+            if (!above_watermark(low_watermark_) || cache_.empty()) {
+                reclaim_scheduled_ = false;
+                return;
+            }
+        }
+        // Lock released between batches so requests interleave with reclaiming
+    }
+}
+
+void KVStore::leave_cold_tier(CacheMap::iterator it) {
+    CacheEntry& entry = it->second;
+    if (!entry.cold) {
+        return;
+    }
+    if (cold_boundary_ == entry.lru_iter) {
+        cold_boundary_ = std::next(cold_boundary_);
+    }
+    entry.cold = false;
+    cold_entries_--;
+    if (entry.raw_size > 0) {
+        cold_bytes_saved_ -= entry.raw_size - entry.value.size();
+    }
+}
+
+void KVStore::promote(CacheMap::iterator it) {
+    CacheEntry& entry = it->second;
+    leave_cold_tier(it);
+    if (entry.raw_size == 0 || compress_values_) {
+        return; // Nothing to undo, or every value is meant to stay compressed
+    }
+    
+    std::string raw = value_of(entry);
+    bytes_used_ -= entry_bytes(it->first.size(), stored_size(entry));
+    release_value(entry);
+    set_value(entry, raw.data(), raw.size());
+    bytes_used_ += entry_bytes(it->first.size(), stored_size(entry));
+}
+
+void KVStore::compress_cold() {
+    size_t target = static_cast<size_t>(lru_list_.size() * cold_fraction_);
+    for (size_t i = 0; i < kColdBatch && cold_entries_ < target && cold_boundary_ != lru_list_.begin(); ++i) {
+        --cold_boundary_;
+        CacheEntry& entry = cache_.find(**cold_boundary_)->second;
+        entry.cold = true;
+        cold_entries_++;
+        
+        if (entry.raw_size == 0 && !entry.shared) {
+            ArenaBuffer raw = std::move(entry.value);
+            if (!compress_into(entry, raw.data(), raw.size())) {
+                entry.value = std::move(raw); // Stays cold but uncompressed
+                continue;
+            }
+            bytes_used_ -= raw.size() - entry.value.size();
+            dispose(std::move(raw));
+        }
+        cold_bytes_saved_ += entry.raw_size - entry.value.size();
+    }
+}
+
+void KVStore::set_value(CacheEntry& entry, const char* data, size_t size) {
+    if (compress_values_ && compress_into(entry, data, size)) {
+        if (dedup_values_ && !entry.value.is_inline()) {
+            share_value(entry, entry.value.data(), entry.value.size());
+        }
+    } else if (dedup_values_ && size > ArenaBuffer::kInlineCapacity) {
+        share_value(entry, data, size);
+    } else {
+        entry.value = ArenaBuffer(*arena_, data, size);
+    }
+}
+
+void KVStore::share_value(CacheEntry& entry, const char* data, size_t size) {
+    // The pool hashes the bytes, then compares them in full on a hash match
+    auto pooled = value_pool_.find(ArenaBuffer::borrow(data, size));
+    if (pooled != value_pool_.end()) {
+        pooled->second++;
+        dedup_bytes_saved_ += size;
+    } else {
+        // Take over the entry's own copy when it already holds the bytes
+        ArenaBuffer owned = entry.value.data() == data ? std::move(entry.value) : ArenaBuffer(*arena_, data, size);
+        pooled = value_pool_.emplace(std::move(owned), 1).first;
+        bytes_used_ += size; // Shared bytes are charged once, here, rather than per entry
+    }
+    entry.value = ArenaBuffer::borrow(pooled->first.data(), size);
+    entry.shared = true;
+}
+
+bool KVStore::compress_into(CacheEntry& entry, const char* data, size_t size) {
+    if (size < kMinCompressSize) {
+        return false;
+    }
+    
+    const lz4::Dictionary* dictionary = nullptr;
+    if (dictionary_version_ != 0) {
+        dictionary = dictionaries_.at(dictionary_version_).dictionary.get();
+    }
+    compress_scratch_.resize(lz4::compress_bound(size));
+    size_t compressed = lz4::compress(data, size, &compress_scratch_[0], compress_scratch_.size(), dictionary);
+    if (compressed == 0 || compressed > size - size / 8) {
+        release_scratch();
+        return false; // Incompressible: not worth a decompression on every access
+    }
+    
+    entry.value = ArenaBuffer(*arena_, compress_scratch_.data(), compressed);
+    entry.raw_size = size;
+    entry.dict_version = dictionary ? dictionary_version_ : 0;
+    if (dictionary) {
+        dictionaries_.at(dictionary_version_).entries++;
+    }
+    compressed_bytes_saved_ += size - compressed;
+    release_scratch();
+    return true;
+}
+
+void KVStore::release_value(CacheEntry& entry) {
+    if (entry.raw_size > 0) {
+        compressed_bytes_saved_ -= entry.raw_size - entry.value.size();
+        if (entry.dict_version != 0) {
+            auto dict = dictionaries_.find(entry.dict_version);
+            if (--dict->second.entries == 0 && dict->first != dictionary_version_) {
+                dictionaries_.erase(dict); // No value needs this older dictionary any more
+                relog_dictionaries();
+            }
+        }
+        entry.raw_size = 0;
+        entry.dict_version = 0;
+    }
+    
+    if (entry.shared) {
+        size_t size = entry.value.size();
+        auto pooled = value_pool_.find(entry.value);
+        entry.value.reset();
+        entry.shared = false;
+        if (--pooled->second > 0) {
+            dedup_bytes_saved_ -= size;
+            return;
+        }
+        bytes_used_ -= size;
+        auto node = value_pool_.extract(pooled);
+        if (snapshot_) {
+            snapshot_->shared.ids.erase(node.key().data()); // A new value may take its address
+        }
+        dispose(std::move(node.key()));
+        return;
+    }
+    dispose(std::move(entry.value));
+}
+
+std::string KVStore::value_of(const CacheEntry& entry) const {
+    if (entry.raw_size == 0) {
+        return entry.value.str();
+    }
+    
+    const lz4::Dictionary* dictionary = nullptr;
+    if (entry.dict_version != 0) {
+        dictionary = dictionaries_.at(entry.dict_version).dictionary.get();
+    }
+    std::string raw(entry.raw_size, '\0');
+    if (!lz4::decompress(entry.value.data(), entry.value.size(), &raw[0], raw.size(), dictionary)) {
+        throw std::runtime_error("Corrupt compressed value");
+    }
+    return raw;
+}
+
+void KVStore::release_scratch() {
+    if (compress_scratch_.capacity() > kMaxScratchSize) {
+        std::string().swap(compress_scratch_);
+    }
+}
+
+void KVStore::maybe_defrag() {
+    if (!active_defrag_ || defrag_scheduled_ || ++writes_since_defrag_check_ < defrag_check_interval_) {
+        return;
+    }
+    writes_since_defrag_check_ = 0;
+    
+    size_t allocated = arena_->allocated_bytes();
+    size_t mapped = arena_->mapped_bytes();
+    if (mapped > allocated + kDefragMinWaste && mapped > allocated * defrag_threshold_) {
+        defrag_scheduled_ = true;
+        submit_background([this] { defrag(); });
+    }
+}
+
+void KVStore::defrag() {
+    uint64_t moved = 0;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            // Readers copy values out under mutex_, so entries can be moved while it is held
+            auto deadline = Clock::now() + defrag_slice_;
+            while (defrag_cursor_ < cache_.bucket_count()) {
+                for (size_t end = defrag_cursor_ + kDefragBucketBatch;
+                     defrag_cursor_ < end && defrag_cursor_ < cache_.bucket_count(); ++defrag_cursor_) {
+                    moved += defrag_bucket(defrag_cursor_);
+                }
+                if (Clock::now() >= deadline) {
+                    break;
+                }
+            }
+            
+            if (defrag_cursor_ >= cache_.bucket_count()) {
+                defrag_cursor_ = 0;
+                defrag_scheduled_ = false;
+                // Back off while the waste is in memory this pass cannot move (index nodes)
+                defrag_check_interval_ = moved > 0 ? kDefragCheckInterval
+                                                   : std::min(defrag_check_interval_ * 2, kMaxDefragCheckInterval);
+                arena_->trim();
+                return;
+            }
+        }
+        // Lock released between slices so requests interleave with defragmenting
+    }
+}
+
+uint64_t KVStore::defrag_bucket(size_t bucket) {
+    // Every copy below is allocated before the old slot is freed, so it lands on a denser page
+    uint64_t moved = 0;
+    std::vector<const ArenaBuffer*> moved_nodes;
+    for (auto it = cache_.begin(bucket); it != cache_.end(bucket); ++it) {
+        CacheEntry& entry = it->second;
+        if (!entry.value.is_inline() && !entry.shared &&
+            arena_->should_relocate(entry.value.data(), entry.value.size())) {
+            entry.value = ArenaBuffer(*arena_, entry.value.data(), entry.value.size());
+            moved++;
+        }
+        if (arena_->should_relocate(&*entry.lru_iter, sizeof(const ArenaBuffer*))) {
+            auto fresh = lru_list_.insert(entry.lru_iter, *entry.lru_iter);
+            if (cold_boundary_ == entry.lru_iter) {
+                cold_boundary_ = fresh;
+            }
+            lru_list_.erase(entry.lru_iter);
+            entry.lru_iter = fresh;
+            moved++;
+        }
+        if (entry.priority_iter != priority_queue_.end() &&
+            arena_->should_relocate(&*entry.priority_iter, sizeof(*entry.priority_iter))) {
+            auto fresh = priority_queue_.emplace_hint(entry.priority_iter, *entry.priority_iter);
+            priority_queue_.erase(entry.priority_iter);
+            entry.priority_iter = fresh;
+            moved++;
+        }
+        const ArenaBuffer& key = it->first;
+        if (arena_->should_relocate(&*it, sizeof(*it)) ||
+            (!key.is_inline() && arena_->should_relocate(key.data(), key.size()))) {
+            moved_nodes.push_back(&key); // Re-inserting invalidates the bucket walk
+        }
+    }
+    
+    // Hash nodes (and out-of-line key bytes) move by re-emplacing their contents while the
+    // old node is still held; the LRU and GDSF entries then point at the new key
+    for (const ArenaBuffer* key : moved_nodes) {
+        auto node = cache_.extract(cache_.find(*key));
+        ArenaBuffer moved_key = std::move(node.key());
+        if (!moved_key.is_inline() && arena_->should_relocate(moved_key.data(), moved_key.size())) {
+            moved_key = ArenaBuffer(*arena_, moved_key.data(), moved_key.size());
+        }
+        auto it = cache_.emplace(std::move(moved_key), std::move(node.mapped())).first;
+        *it->second.lru_iter = &it->first;
+        if (it->second.priority_iter != priority_queue_.end()) {
+            it->second.priority_iter->second = &it->first;
+        }
+        moved++;
+    }
+    
+    defrag_moves_ += moved;
+    return moved;
+}
+
+void KVStore::dispose(ArenaBuffer&& value) {
+    if (lazy_free_threshold_ == 0 || value.size() < lazy_free_threshold_) {
+        return; // Small values are freed by the caller as usual
+    }
+    
+    pending_frees_.push_back(std::move(value));
+    if (!free_scheduled_) {
+        free_scheduled_ = true;
+        submit_background([this] {
+            std::vector<ArenaBuffer> frees;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                frees.swap(pending_frees_);
+                free_scheduled_ = false;
+            }
+            // Values are destroyed here, off the request path and outside the lock
+        });
+    }
+}
+
+void KVStore::detach_tables(DetachedTables& tables) {
+    tables.cache.swap(cache_);
+    if (key_filter_) {
+        key_filter_->clear();
+    }
+    if (shared_table_) {
+        shared_table_->clear();
+    }
+    tables.lru_list.swap(lru_list_);
+    tables.priority_queue.swap(priority_queue_);
+    tables.pending_frees.swap(pending_frees_);
+    tables.value_pool.swap(value_pool_);
+    bytes_used_ = 0;
+    dedup_bytes_saved_ = 0;
+    cold_boundary_ = lru_list_.end();
+    cold_entries_ = 0;
+    cold_bytes_saved_ = 0;
+    compressed_bytes_saved_ = 0;
+    
+    // Detached values are never decoded again, so only the current dictionary is still needed
+    for (auto dict = dictionaries_.begin(); dict != dictionaries_.end();) {
+        dict->second.entries = 0;
+        dict = dict->first == dictionary_version_ ? std::next(dict) : dictionaries_.erase(dict);
+    }
+    relog_dictionaries();
+    if (replicas_) {
+        replicas_->clear();
+    }
+}
+
+BackgroundWorker& KVStore::background() {
+    if (!background_) {
+        background_ = std::make_shared<BackgroundWorker>(numa_node_);
+    }
+    return *background_;
+}
+
+void KVStore::submit_background(std::function<void()> task) {
+    background_tasks_++;
+    background().submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            // Still count the task as finished below
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--background_tasks_ == 0) {
+            background_idle_.notify_all();
+        }
+    });
+}
+
+void KVStore::commit_wal(WalWriter* wal) {
+    if (wal) {
+        wal->commit();
+    }
+}
+
+void KVStore::write_wal(const std::string& operation, const std::string& key, const std::string& value) {
+    if (!wal_file_) {
+        return;
+    }
+    
+    bool rolled = value.empty() ? wal_file_->append({operation, " ", key, "\n"})
+                                : wal_file_->append({operation, " ", key, " ", value, "\n"});
+    if (wal_file_->failed() && !wal_failure_reported_) {
+        wal_failure_reported_ = true;
+        std::cerr << "Warning: Failed to write WAL file: " << wal_path_ << "; records may be missing" << std::endl;
+    }
     
-    *wal_file_ << operation << " " << key;
-    if (!value.empty()) {
-        *wal_file_ << " " << value;
+    // Each roll uses up a spare; prepare the next ones before they are needed
+    if (rolled && !wal_prepare_scheduled_ && wal_file_->needs_segments()) {
+        wal_prepare_scheduled_ = true;
+        WalWriter* wal = wal_file_.get();
+        submit_background([this, wal] {
+            wal->prepare_segments();
+            std::lock_guard<std::mutex> lock(mutex_);
+            wal_prepare_scheduled_ = false;
+        });
     }
-    *wal_file_ << std::endl;
-    wal_file_->flush(); // Ensure durability
 }
 
 } // namespace kvstore
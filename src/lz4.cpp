@@ -0,0 +1,311 @@
+#include "lz4.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace kvstore {
+namespace lz4 {
+
+namespace {
+
+// Block format limits: matches are at least 4 bytes, the last 5 bytes are always
+// literals and the last match starts at least 12 bytes before the end
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMatchFindLimit = 12;
+constexpr size_t kMaxOffset = 65535;
+
+constexpr int kHashBits = 12;
+
+// Dictionary training: substring length scored, and length of each kept segment
+constexpr size_t kTrainKmer = 8;
+constexpr size_t kTrainSegment = 64;
+constexpr int kTrainHashBits = 18;
+
+// Misses before the search starts skipping ahead faster over incompressible input
+constexpr int kSkipShift = 6;
+
+uint32_t read32(const char* ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+uint32_t kmer_hash(const char* ptr) {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return static_cast<uint32_t>((value * 0x9E3779B97F4A7C15ull) >> (64 - kTrainHashBits));
+}
+
+// Lengths of 15 and up continue in bytes of 255 after the token nibble
+char* write_length(char* out, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *out++ = static_cast<char>(255);
+        length -= 255;
+    }
+    *out++ = static_cast<char>(length);
+    return out;
+}
+
+bool read_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in >= end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+char* write_sequence(char* out, const char* literals, size_t literal_length,
+                     size_t offset, size_t match_length) {
+    char* token = out++;
+    *token = static_cast<char>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) {
+        out = write_length(out, literal_length);
+    }
+    std::memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    if (offset == 0) {
+        return out; // Final literal-only sequence
+    }
+
+    *out++ = static_cast<char>(offset & 0xff);
+    *out++ = static_cast<char>(offset >> 8);
+    match_length -= kMinMatch;
+    *token |= static_cast<char>(std::min<size_t>(match_length, 15));
+    if (match_length >= 15) {
+        out = write_length(out, match_length);
+    }
+    return out;
+}
+
+} // namespace
+
+Dictionary::Dictionary(std::string content)
+    : content_(std::move(content)), table_(1 << kHashBits, 0) {
+    if (content_.size() > kMaxOffset) {
+        content_.erase(0, content_.size() - kMaxOffset);
+    }
+    // Later positions overwrite earlier ones, so lookups find the closest (cheapest) match
+    for (size_t pos = 0; pos + sizeof(uint32_t) <= content_.size(); ++pos) {
+        table_[hash(read32(content_.data() + pos))] = static_cast<uint32_t>(pos + 1);
+    }
+}
+
+std::string train_dictionary(const std::vector<std::string>& samples, size_t max_size) {
+    std::string corpus;
+    for (const std::string& sample : samples) {
+        corpus += sample;
+    }
+    if (corpus.size() <= max_size || corpus.size() < kTrainSegment) {
+        return corpus.substr(corpus.size() - std::min(corpus.size(), max_size));
+    }
+    
+    size_t kmers = corpus.size() - kTrainKmer + 1;
+    std::vector<uint32_t> hashes(kmers);
+    std::vector<uint32_t> frequency(1 << kTrainHashBits, 0);
+    for (size_t i = 0; i < kmers; ++i) {
+        hashes[i] = kmer_hash(corpus.data() + i);
+        frequency[hashes[i]]++;
+    }
+    
+    // One segment per epoch spreads the dictionary over the whole sample set
+    const size_t window = kTrainSegment - kTrainKmer + 1;
+    size_t epochs = std::max<size_t>(1, max_size / kTrainSegment);
+    size_t epoch_size = std::max(kTrainSegment, corpus.size() / epochs);
+    
+    std::string dictionary;
+    for (size_t begin = 0; begin + kTrainSegment <= corpus.size() &&
+                           dictionary.size() + kTrainSegment <= max_size; begin += epoch_size) {
+        size_t end = std::min(corpus.size(), begin + epoch_size);
+        
+        // Rolling sum of k-mer frequencies over each segment-sized window
+        uint64_t score = 0;
+        for (size_t i = begin; i < begin + window; ++i) {
+            score += frequency[hashes[i]];
+        }
+        uint64_t best_score = score;
+        size_t best = begin;
+        for (size_t start = begin + 1; start + kTrainSegment <= end; ++start) {
+            score += frequency[hashes[start + window - 1]];
+            score -= frequency[hashes[start - 1]];
+            if (score > best_score) {
+                best_score = score;
+                best = start;
+            }
+        }
+        if (best_score <= window) {
+            continue; // Nothing in this epoch repeats elsewhere
+        }
+        
+        dictionary.append(corpus, best, kTrainSegment);
+        for (size_t i = best; i < best + window; ++i) {
+            frequency[hashes[i]] = 0; // Covered: later segments gain nothing from it
+        }
+    }
+    return dictionary;
+}
+
+size_t compress(const char* src, size_t size, char* dst, size_t capacity, const Dictionary* dictionary) {
+    if (capacity < compress_bound(size) || size > std::numeric_limits<uint32_t>::max()) {
+        return 0;
+    }
+
+    const char* end = src + size;
+    const char* anchor = src;
+    char* out = dst;
+
+    if (size > kMatchFindLimit) {
+        const char* match_limit = end - kMatchFindLimit;
+        const char* extend_limit = end - kLastLiterals;
+
+        // Position of the last occurrence of each 4-byte hash; 0 is safe as every
+        // candidate is verified against the input
+        uint32_t table[1 << kHashBits] = {};
+        const char* ip = src + 1;
+        uint32_t misses = 0;
+
+        // A dictionary sits logically just before src: offsets into it count back from
+        // src through its end, and matches there stop at its end
+        const char* dict_begin = dictionary ? dictionary->content_.data() : nullptr;
+        const char* dict_end = dictionary ? dict_begin + dictionary->content_.size() : nullptr;
+
+        while (ip < match_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash(sequence);
+            const char* ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+
+            // Where the candidate's bytes live and how far it may extend either way
+            const char* ref_begin = src;
+            const char* ref_limit = extend_limit;
+            size_t offset = ip - ref;
+            if (ref >= ip || offset > kMaxOffset || read32(ref) != sequence) {
+                uint32_t candidate = dictionary ? dictionary->table_[h] : 0;
+                if (candidate != 0) {
+                    ref = dict_begin + candidate - 1;
+                    offset = (ip - src) + (dict_end - ref);
+                }
+                if (candidate == 0 || offset > kMaxOffset || read32(ref) != sequence) {
+                    ip += 1 + (misses++ >> kSkipShift);
+                    continue;
+                }
+                ref_begin = dict_begin;
+                ref_limit = dict_end;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > ref_begin && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const char* match_end = ip + kMinMatch;
+            const char* ref_end = ref + kMinMatch;
+            while (match_end < extend_limit && ref_end < ref_limit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            out = write_sequence(out, anchor, ip - anchor, offset, match_end - ip);
+            ip = match_end;
+            anchor = ip;
+
+            if (ip < match_limit) {
+                table[hash(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+            }
+        }
+    }
+
+    out = write_sequence(out, anchor, end - anchor, 0, 0);
+    return out - dst;
+}
+
+bool decompress(const char* src, size_t size, char* dst, size_t original_size, const Dictionary* dictionary) {
+    size_t dict_size = dictionary ? dictionary->content().size() : 0;
+
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* in_end = in + size;
+    char* out = dst;
+    char* out_end = dst + original_size;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(in, in_end, literal_length)) {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(in_end - in) ||
+            literal_length > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        std::memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+
+        if (in == in_end) {
+            break; // The last sequence has no match
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        size_t produced = out - dst;
+        if (offset == 0 || offset > produced + dict_size) {
+            return false;
+        }
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(in, in_end, match_length)) {
+            return false;
+        }
+        match_length += kMinMatch;
+        if (match_length > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+
+        if (offset > produced) {
+            // Starts in the dictionary and may run on into the start of the output
+            size_t back = offset - produced;
+            const char* ref = dictionary->content().data() + dict_size - back;
+            size_t from_dictionary = std::min(back, match_length);
+            std::memcpy(out, ref, from_dictionary);
+            out += from_dictionary;
+            match_length -= from_dictionary;
+            for (size_t i = 0; i < match_length; ++i) {
+                out[i] = dst[i];
+            }
+            out += match_length;
+            continue;
+        }
+
+        const char* ref = out - offset;
+        if (offset >= match_length) {
+            std::memcpy(out, ref, match_length);
+        } else {
+            // Overlapping match repeats the last offset bytes
+            for (size_t i = 0; i < match_length; ++i) {
+                out[i] = ref[i];
+            }
+        }
+        out += match_length;
+    }
+
+    return out == out_end;
+}
+
+} // namespace lz4
+} // namespace kvstore
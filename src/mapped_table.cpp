@@ -0,0 +1,463 @@
+#include "mapped_table.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kvstore {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x3250414D5453564Bull; // "KVSTMAP2"
+constexpr uint64_t kHashSeed = 0x452821E638D01377ull;
+constexpr uint64_t kChecksumSeed = 0xBE5466CF34E90C6Cull;
+constexpr size_t kHeaderSize = 64;
+constexpr size_t kMaxProbe = 64;
+
+// Attempts at a slot that keeps changing before a shared-memory reader gives up on it
+// (its writer may have died mid-update) and probes on
+constexpr int kMaxReadAttempts = 1024;
+
+enum SlotState : uint32_t {
+    kEmpty = 0,
+    kLive = 1,
+    kTombstone = 2
+};
+
+// A slot's state word holds its SlotState in the low bits and, above them, the low bits of
+// the table generation it was written in; slots of an earlier generation read as empty
+constexpr uint32_t kStateMask = 3;
+constexpr uint32_t kGenerationShift = 2;
+
+// Mixes the full generation into record checksums, so a slot whose generation bits wrapped
+// around to the current ones still fails its checksum
+constexpr uint64_t kGenerationMix = 0x9E3779B97F4A7C15ull;
+
+enum TableClock : uint32_t {
+    kSteadyClock = 0, // Shared memory: the monotonic clock every local process shares
+    kSystemClock = 1  // Files: wall time, which survives reboots
+};
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t os_page_size() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+} // namespace
+
+struct MappedTable::Header {
+    std::atomic<uint64_t> magic; // Stored last by the writer, so a half-built table never opens
+    uint64_t slot_count;
+    uint64_t slot_size;
+    std::atomic<uint64_t> entries;
+    std::atomic<uint32_t> closed;
+    uint32_t clock;
+    std::atomic<uint64_t> generation; // Bumped by clear(); zero in a new table
+};
+
+// Every field is atomic because readers load them while the writer may be storing
+struct MappedTable::Slot {
+    std::atomic<uint32_t> seq; // Odd while the writer is rewriting the slot
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> key_size;
+    std::atomic<uint32_t> value_size;
+    std::atomic<uint64_t> hash;
+    std::atomic<int64_t> expires_at;
+    std::atomic<uint64_t> checksum; // Over the key, value and deadline of a live record
+
+    char* data() {
+        return reinterpret_cast<char*>(this + 1); // Key, then value
+    }
+    const char* data() const {
+        return reinterpret_cast<const char*>(this + 1);
+    }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be address-free");
+
+std::unique_ptr<MappedTable> MappedTable::create_shared(const std::string& name, size_t slots, size_t slot_size) {
+    size_t slot_count = 1;
+    while (slot_count < slots) {
+        slot_count <<= 1;
+    }
+    slot_size = round_up(std::max(slot_size, sizeof(Slot) + 1), 64);
+    size_t length = kHeaderSize + slot_count * slot_size;
+
+    // Readers of a previous incarnation keep their mapping; new readers get this one
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* base = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(length)) == 0) {
+        base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    // ftruncate zero-filled the region: every slot starts empty with an even sequence
+    Header* header = static_cast<Header*>(base);
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->clock = kSteadyClock;
+    header->magic.store(kMagic, std::memory_order_release);
+    return std::unique_ptr<MappedTable>(new MappedTable(base, length, true, name, -1, false));
+}
+
+std::unique_ptr<MappedTable> MappedTable::open_shared(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    void* base = nullptr;
+    if (fstat(fd, &st) == 0) {
+        base = map_table(fd, st.st_size, false);
+    }
+    close(fd);
+    if (!base) {
+        return nullptr;
+    }
+    return std::unique_ptr<MappedTable>(new MappedTable(base, st.st_size, false, name, -1, false));
+}
+
+std::unique_ptr<MappedTable> MappedTable::open_file(const std::string& path, size_t slots, size_t slot_size,
+                                                    bool sync) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* base = nullptr;
+    size_t length = st.st_size;
+    if (length > 0) {
+        base = map_table(fd, length, true);
+    } else {
+        size_t slot_count = 1;
+        while (slot_count < slots) {
+            slot_count <<= 1;
+        }
+        slot_size = round_up(std::max(slot_size, sizeof(Slot) + 1), 64);
+        length = kHeaderSize + slot_count * slot_size;
+        if (ftruncate(fd, static_cast<off_t>(length)) == 0) {
+            base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            base = base == MAP_FAILED ? nullptr : base;
+        }
+        if (base) {
+            // The magic goes to disk only after the rest of the header is there
+            Header* header = static_cast<Header*>(base);
+            header->slot_count = slot_count;
+            header->slot_size = slot_size;
+            header->clock = kSystemClock;
+            msync(base, kHeaderSize, MS_SYNC);
+            header->magic.store(kMagic, std::memory_order_release);
+            msync(base, kHeaderSize, MS_SYNC);
+        }
+    }
+    if (!base) {
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<MappedTable>(new MappedTable(base, length, true, "", fd, sync));
+}
+
+void* MappedTable::map_table(int fd, size_t length, bool writable) {
+    if (length < kHeaderSize) {
+        return nullptr;
+    }
+    void* base = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    const Header* header = static_cast<const Header*>(base);
+    bool valid = header->magic.load(std::memory_order_acquire) == kMagic &&
+                 header->slot_size > sizeof(Slot) && header->slot_count > 0 &&
+                 (header->slot_count & (header->slot_count - 1)) == 0 &&
+                 kHeaderSize + header->slot_count * header->slot_size == length;
+    if (!valid) {
+        munmap(base, length);
+        return nullptr;
+    }
+    return base;
+}
+
+MappedTable::MappedTable(void* base, size_t length, bool writer, std::string name, int fd, bool sync)
+    : header_(static_cast<Header*>(base)),
+      slots_(static_cast<char*>(base) + kHeaderSize),
+      length_(length),
+      mask_(header_->slot_count - 1),
+      slot_size_(header_->slot_size),
+      writer_(writer),
+      name_(std::move(name)),
+      fd_(fd),
+      sync_(sync) {
+    static_assert(sizeof(Slot) == 40, "slot header layout is shared between processes");
+    static_assert(sizeof(Header) <= kHeaderSize, "header must fit before the first slot");
+}
+
+MappedTable::~MappedTable() {
+    if (fd_ >= 0) {
+        msync(header_, length_, MS_SYNC);
+        close(fd_);
+    } else if (writer_) {
+        header_->closed.store(1, std::memory_order_release);
+        shm_unlink(name_.c_str());
+    }
+    munmap(header_, length_);
+}
+
+MappedTable::Slot* MappedTable::slot_at(size_t index) const {
+    return reinterpret_cast<Slot*>(slots_ + (index & mask_) * slot_size_);
+}
+
+int64_t MappedTable::now() const {
+    using std::chrono::nanoseconds;
+    if (header_->clock == kSystemClock) {
+        return std::chrono::duration_cast<nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+    return std::chrono::duration_cast<nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t MappedTable::state_of(const Slot* slot, uint64_t generation) {
+    uint32_t word = slot->state.load(std::memory_order_relaxed);
+    if ((word >> kGenerationShift) != static_cast<uint32_t>(generation & (UINT32_MAX >> kGenerationShift))) {
+        return kEmpty; // Dropped by a clear() since
+    }
+    return word & kStateMask;
+}
+
+bool MappedTable::intact(const Slot* slot, uint64_t generation) const {
+    if (slot->seq.load(std::memory_order_relaxed) & 1) {
+        return false;
+    }
+    size_t size = static_cast<size_t>(slot->key_size.load(std::memory_order_relaxed)) +
+                  slot->value_size.load(std::memory_order_relaxed);
+    uint64_t seed = kChecksumSeed ^ generation * kGenerationMix ^ slot->expires_at.load(std::memory_order_relaxed);
+    return size <= slot_size_ - sizeof(Slot) &&
+           hash64(slot->data(), size, seed) == slot->checksum.load(std::memory_order_relaxed);
+}
+
+std::optional<std::string> MappedTable::get(std::string_view key, std::chrono::nanoseconds* ttl) const {
+    uint64_t hash = hash64(key.data(), key.size(), kHashSeed);
+    uint64_t generation = header_->generation.load(std::memory_order_acquire);
+
+    // The writer's own reads never overlap a write, so an odd sequence there means a torn slot
+    int max_attempts = writer_ ? 1 : kMaxReadAttempts;
+    for (size_t probe = 0; probe < kMaxProbe; ++probe) {
+        const Slot* slot = slot_at(hash + probe);
+        for (int attempt = 0; attempt < max_attempts; ++attempt) {
+            uint32_t seq = slot->seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+
+            uint32_t state = state_of(slot, generation);
+            int64_t expires_at = slot->expires_at.load(std::memory_order_relaxed);
+            bool match = state == kLive && slot->hash.load(std::memory_order_relaxed) == hash &&
+                         slot->key_size.load(std::memory_order_relaxed) == key.size() && intact(slot, generation) &&
+                         std::memcmp(slot->data(), key.data(), key.size()) == 0;
+            std::string value;
+            if (match) {
+                value.assign(slot->data() + key.size(), slot->value_size.load(std::memory_order_relaxed));
+            }
+
+            // Whatever was read is only trusted if no write overlapped it
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            if (state == kEmpty) {
+                return std::nullopt; // End of the probe chain
+            }
+            if (!match) {
+                break;
+            }
+            int64_t remaining = expires_at == 0 ? 0 : expires_at - now();
+            if (expires_at != 0 && remaining <= 0) {
+                return std::nullopt;
+            }
+            if (ttl) {
+                *ttl = std::chrono::nanoseconds(remaining);
+            }
+            return value;
+        }
+    }
+    return std::nullopt;
+}
+
+MappedTable::Slot* MappedTable::find(std::string_view key, uint64_t hash, Slot** free, const Slot* skip) const {
+    *free = nullptr;
+    Slot* found = nullptr;
+    uint64_t generation = header_->generation.load(std::memory_order_relaxed);
+    for (size_t probe = 0; probe < kMaxProbe && !(found && *free); ++probe) {
+        Slot* slot = slot_at(hash + probe);
+        uint32_t state = state_of(slot, generation);
+        bool torn = slot->seq.load(std::memory_order_relaxed) & 1;
+        if (state != kLive || torn) {
+            if (!*free) {
+                *free = slot;
+            }
+            if (state == kEmpty && !torn) {
+                break; // End of the probe chain
+            }
+            continue;
+        }
+        if (found || slot == skip || slot->hash.load(std::memory_order_relaxed) != hash ||
+            slot->key_size.load(std::memory_order_relaxed) != key.size() ||
+            std::memcmp(slot->data(), key.data(), key.size()) != 0) {
+            continue;
+        }
+        if (intact(slot, generation)) {
+            found = slot;
+        } else if (!*free) {
+            *free = slot; // A torn copy of this key: reuse it
+        }
+    }
+    return found;
+}
+
+size_t MappedTable::max_record_size() const {
+    return slot_size_ - sizeof(Slot);
+}
+
+bool MappedTable::put(std::string_view key, std::string_view value, std::chrono::nanoseconds ttl) {
+    if (key.size() + value.size() > max_record_size()) {
+        erase(key); // Do not leave a stale value visible
+        return false;
+    }
+
+    uint64_t hash = hash64(key.data(), key.size(), kHashSeed);
+    int64_t expires_at = ttl.count() > 0 ? now() + ttl.count() : 0;
+    Slot* free;
+    Slot* old = find(key, hash, &free);
+    if (!free) {
+        // No spare slot for a shadow copy. A slot is never rewritten in place, as a crash
+        // mid-write would lose the key; the update is refused and the old value retired,
+        // so a stale copy is not served later
+        if (old) {
+            erase(key);
+        }
+        return false;
+    }
+
+    // New record first, durable, then retire every older copy (a crash in between can
+    // leave two; the next write of the key removes the extra one)
+    write_slot(free, kLive, hash, key, value, expires_at);
+    sync(free);
+    if (!old) {
+        header_->entries.fetch_add(1, std::memory_order_relaxed);
+    }
+    Slot* unused;
+    while ((old = find(key, hash, &unused, free))) {
+        remove_slot(old);
+    }
+    return true;
+}
+
+bool MappedTable::erase(std::string_view key) {
+    uint64_t hash = hash64(key.data(), key.size(), kHashSeed);
+    Slot* unused;
+    Slot* slot = find(key, hash, &unused);
+    if (!slot) {
+        return false;
+    }
+    header_->entries.fetch_sub(1, std::memory_order_relaxed);
+    do {
+        remove_slot(slot);
+    } while ((slot = find(key, hash, &unused)));
+    return true;
+}
+
+void MappedTable::clear() {
+    // Every slot now belongs to an earlier generation and reads as empty; slots are
+    // overwritten as they are reused rather than walked here
+    header_->generation.fetch_add(1, std::memory_order_release);
+    header_->entries.store(0, std::memory_order_relaxed);
+    if (sync_) {
+        msync(header_, kHeaderSize, MS_SYNC);
+    }
+}
+
+void MappedTable::write_slot(Slot* slot, uint32_t state, uint64_t hash, std::string_view key,
+                             std::string_view value, int64_t expires_at) {
+    uint64_t generation = header_->generation.load(std::memory_order_relaxed);
+
+    // A torn slot's sequence is odd already; step it to the next odd value
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed) | 1;
+    slot->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // An empty view's data() may be null, which memcpy does not allow even for zero bytes
+    if (!key.empty()) {
+        std::memcpy(slot->data(), key.data(), key.size());
+    }
+    if (!value.empty()) {
+        std::memcpy(slot->data() + key.size(), value.data(), value.size());
+    }
+    slot->state.store(state | static_cast<uint32_t>(generation << kGenerationShift), std::memory_order_relaxed);
+    slot->key_size.store(static_cast<uint32_t>(key.size()), std::memory_order_relaxed);
+    slot->value_size.store(static_cast<uint32_t>(value.size()), std::memory_order_relaxed);
+    slot->hash.store(hash, std::memory_order_relaxed);
+    slot->expires_at.store(expires_at, std::memory_order_relaxed);
+    slot->checksum.store(hash64(slot->data(), key.size() + value.size(),
+                                kChecksumSeed ^ generation * kGenerationMix ^ expires_at),
+                         std::memory_order_relaxed);
+
+    slot->seq.store(seq + 1, std::memory_order_release);
+}
+
+void MappedTable::remove_slot(Slot* slot) {
+    size_t index = (reinterpret_cast<char*>(slot) - slots_) / slot_size_;
+    uint64_t generation = header_->generation.load(std::memory_order_relaxed);
+    if (state_of(slot_at(index + 1), generation) != kEmpty) {
+        write_slot(slot, kTombstone, 0, {}, {}, 0); // Other chains may still run through it
+        sync(slot);
+        return;
+    }
+    // Nothing probes past an empty successor, so this slot and the tombstones before it
+    // no longer carry any chain
+    write_slot(slot, kEmpty, 0, {}, {}, 0);
+    sync(slot);
+    for (size_t i = index - 1; state_of(slot_at(i), generation) == kTombstone; --i) {
+        write_slot(slot_at(i), kEmpty, 0, {}, {}, 0);
+        sync(slot_at(i));
+    }
+}
+
+void MappedTable::sync(const Slot* slot) const {
+    if (!sync_) {
+        return;
+    }
+    uintptr_t begin = reinterpret_cast<uintptr_t>(slot) & ~(os_page_size() - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(slot) + slot_size_;
+    msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC);
+}
+
+size_t MappedTable::size() const {
+    return header_->entries.load(std::memory_order_relaxed);
+}
+
+bool MappedTable::closed() const {
+    return header_->closed.load(std::memory_order_acquire) != 0;
+}
+
+} // namespace kvstore
@@ -0,0 +1,87 @@
+#include "numa.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace kvstore {
+namespace numa {
+
+namespace {
+
+// From <numaif.h>; defined here so libnuma is not a build dependency
+constexpr int kMpolBind = 2;
+
+const char* const kNodeRoot = "/sys/devices/system/node/node";
+
+} // namespace
+
+std::vector<int> node_cpus(int node) {
+    std::vector<int> cpus;
+    std::ifstream in(kNodeRoot + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!in.is_open() || !std::getline(in, list)) {
+        return cpus;
+    }
+    
+    // Format: comma-separated ids and ranges, e.g. "0-3,8-11"
+    std::istringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+bool pin_current_thread(int node) {
+#ifdef __linux__
+    std::vector<int> cpus = node_cpus(node);
+    if (cpus.empty()) {
+        return false;
+    }
+    
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+bool bind_memory(void* addr, size_t length, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, addr, length, kMpolBind, &mask, sizeof(mask) * 8, 0) == 0;
+#else
+    (void)addr;
+    (void)length;
+    (void)node;
+    return false;
+#endif
+}
+
+} // namespace numa
+} // namespace kvstore
@@ -0,0 +1,163 @@
+#include "tenant_scheduler.hpp"
+#include "numa.hpp"
+
+#include <algorithm>
+
+namespace kvstore {
+
+TenantScheduler::TenantScheduler(KVStore& store, size_t num_workers, int numa_node)
+    : store_(store), numa_node_(numa_node) {
+    for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i) {
+        workers_.emplace_back(&TenantScheduler::run, this);
+    }
+}
+
+TenantScheduler::~TenantScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+bool TenantScheduler::add_tenant(const std::string& tenant, const TenantQuota& quota,
+                                 const StoreOptions& options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tenants_.count(tenant) > 0) {
+        return false;
+    }
+    
+    StoreOptions keyspace_options = options;
+    if (quota.max_bytes > 0) {
+        keyspace_options.max_bytes = quota.max_bytes;
+    }
+    KVStore* keyspace = store_.create_namespace(tenant, keyspace_options);
+    if (!keyspace) {
+        return false;
+    }
+    
+    auto state = std::make_unique<Tenant>();
+    state->quota = quota;
+    state->quota.weight = std::max<uint32_t>(quota.weight, 1);
+    if (state->quota.burst <= 0.0) {
+        state->quota.burst = std::max(quota.max_ops_per_second, 1.0);
+    }
+    state->keyspace = keyspace;
+    state->tokens = state->quota.burst;
+    state->last_refill = std::chrono::steady_clock::now();
+    
+    ring_.push_back(state.get());
+    tenants_.emplace(tenant, std::move(state));
+    return true;
+}
+
+SubmitStatus TenantScheduler::submit(const std::string& tenant, Request request) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        auto it = tenants_.find(tenant);
+        if (it == tenants_.end()) {
+            return SubmitStatus::UnknownTenant;
+        }
+        
+        Tenant& state = *it->second;
+        if (state.queue.size() >= state.quota.max_queue_depth) {
+            return SubmitStatus::QueueFull;
+        }
+        if (!take_token(state)) {
+            return SubmitStatus::RateLimited;
+        }
+        
+        state.queue.push_back(std::move(request));
+        queued_++;
+    }
+    work_cv_.notify_one();
+    return SubmitStatus::Accepted;
+}
+
+void TenantScheduler::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return queued_ == 0 && running_ == 0; });
+}
+
+bool TenantScheduler::take_token(Tenant& tenant) {
+    if (tenant.quota.max_ops_per_second <= 0.0) {
+        return true;
+    }
+    
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - tenant.last_refill).count();
+    tenant.last_refill = now;
+    tenant.tokens = std::min(tenant.quota.burst, tenant.tokens + elapsed * tenant.quota.max_ops_per_second);
+    
+    if (tenant.tokens < 1.0) {
+        return false;
+    }
+    tenant.tokens -= 1.0;
+    return true;
+}
+
+std::pair<TenantScheduler::Tenant*, TenantScheduler::Request> TenantScheduler::next_request() {
+    while (true) {
+        Tenant* tenant = ring_[cursor_];
+        
+        if (tenant->queue.empty()) {
+            // Idle tenants do not bank credit for later
+            tenant->deficit = 0;
+            cursor_ = (cursor_ + 1) % ring_.size();
+            continue;
+        }
+        
+        if (tenant->deficit == 0) {
+            tenant->deficit = tenant->quota.weight; // Start of this tenant's turn
+        }
+        
+        Request request = std::move(tenant->queue.front());
+        tenant->queue.pop_front();
+        queued_--;
+        
+        if (--tenant->deficit == 0 || tenant->queue.empty()) {
+            tenant->deficit = 0;
+            cursor_ = (cursor_ + 1) % ring_.size();
+        }
+        return {tenant, std::move(request)};
+    }
+}
+
+void TenantScheduler::run() {
+    if (numa_node_ >= 0) {
+        numa::pin_current_thread(numa_node_);
+    }
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    
+    while (true) {
+        work_cv_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+        if (queued_ == 0) {
+            return; // Stopping and fully drained
+        }
+        
+        auto next = next_request();
+        running_++;
+        
+        lock.unlock();
+        try {
+            next.second(*next.first->keyspace);
+        } catch (...) {
+            // Requests report their own results; a throwing request must not kill the worker
+        }
+        next.second = nullptr;
+        lock.lock();
+        
+        running_--;
+        if (queued_ == 0 && running_ == 0) {
+            idle_cv_.notify_all();
+        }
+    }
+}
+
+} // namespace kvstore
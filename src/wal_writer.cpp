@@ -0,0 +1,746 @@
+#include "wal_writer.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kvstore {
+
+namespace {
+
+// Records gathered before a Buffered log writes them out
+constexpr size_t kBufferSize = 64 * 1024;
+
+// Spare segments kept ready ahead of the one being written
+constexpr uint64_t kSpareSegments = 2;
+
+// Zeros written per call when recycling a segment
+constexpr size_t kZeroChunk = 1024 * 1024;
+
+// Framed block: magic, checksum of the rest, payload length (kShadow set in a shadow
+// image of the block before), offset of the first record starting in the payload
+// (kNoRecord if none), then the payload and zero padding
+constexpr size_t kFrameBlock = 4096;
+constexpr size_t kFrameHeader = 12;
+constexpr size_t kFramePayload = kFrameBlock - kFrameHeader;
+constexpr uint32_t kFrameMagic = 0x4257564B; // "KVWB"
+constexpr uint16_t kNoRecord = 0xFFFF;
+constexpr uint16_t kShadow = 0x8000;
+constexpr uint64_t kFrameSeed = 0x082EFA98EC4E6C89ull;
+
+uint32_t frame_checksum(const char* block, size_t length) {
+    return static_cast<uint32_t>(hash64(block + 8, 4 + length, kFrameSeed));
+}
+
+void seal_block(char* block, size_t length, uint16_t first_record, bool shadow = false) {
+    uint16_t length16 = static_cast<uint16_t>(length | (shadow ? kShadow : 0));
+    std::memcpy(block, &kFrameMagic, 4);
+    std::memcpy(block + 8, &length16, 2);
+    std::memcpy(block + 10, &first_record, 2);
+    std::memset(block + kFrameHeader + length, 0, kFramePayload - length);
+    uint32_t checksum = frame_checksum(block, length);
+    std::memcpy(block + 4, &checksum, 4);
+}
+
+// Check a framed block's header and checksum
+bool parse_block(const char* block, size_t& length, uint16_t& first_record, bool& shadow) {
+    uint32_t magic, checksum;
+    uint16_t length16;
+    std::memcpy(&magic, block, 4);
+    std::memcpy(&checksum, block + 4, 4);
+    std::memcpy(&length16, block + 8, 2);
+    std::memcpy(&first_record, block + 10, 2);
+    shadow = (length16 & kShadow) != 0;
+    length = length16 & ~kShadow;
+    return magic == kFrameMagic && length <= kFramePayload &&
+           (first_record == kNoRecord || first_record < length) && checksum == frame_checksum(block, length);
+}
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+std::string segment_name(const std::string& path, uint64_t number) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%06llu", static_cast<unsigned long long>(number));
+    return path + suffix;
+}
+
+// Segment numbers present for a log, in ascending order
+std::vector<uint64_t> segment_numbers(const std::string& path) {
+    std::filesystem::path log(path);
+    std::filesystem::path dir = log.has_parent_path() ? log.parent_path() : std::filesystem::path(".");
+    std::string prefix = log.filename().string() + ".";
+
+    std::vector<uint64_t> numbers;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            !std::all_of(name.begin() + prefix.size(), name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            continue;
+        }
+        numbers.push_back(std::stoull(name.substr(prefix.size())));
+    }
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+bool write_all(int fd, const char* data, size_t size, uint64_t offset, bool positioned) {
+    while (size > 0) {
+        ssize_t written = positioned ? pwrite(fd, data, size, static_cast<off_t>(offset)) : write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// Create (or replace) a file of @p size bytes whose blocks are all allocated
+bool preallocate(const std::string& path, size_t size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool allocated = posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0 && fdatasync(fd) == 0;
+    close(fd);
+    if (!allocated) {
+        unlink(path.c_str());
+    }
+    return allocated;
+}
+
+// Overwrite the first @p size bytes of a file with zeros, dropping anything past them
+bool zero_fill(const std::string& path, size_t size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const std::string zeros(std::min(size, kZeroChunk), '\0');
+    bool filled = true;
+    for (uint64_t offset = 0; filled && offset < size; offset += zeros.size()) {
+        filled = write_all(fd, zeros.data(), std::min<uint64_t>(zeros.size(), size - offset), offset, true);
+    }
+    filled = filled && ftruncate(fd, static_cast<off_t>(size)) == 0 && fdatasync(fd) == 0;
+    close(fd);
+    return filled;
+}
+
+// A used segment never starts with a zero byte
+bool has_records(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char first = '\0';
+    bool used = pread(fd, &first, 1, 0) == 1 && first != '\0';
+    close(fd);
+    return used;
+}
+
+// Whether a log file already holds records in the other format than @p framed
+bool other_format(const std::string& path, bool framed) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    uint32_t magic = 0;
+    ssize_t read = pread(fd, &magic, sizeof(magic), 0);
+    close(fd);
+    return read > 0 && (magic == kFrameMagic) != framed;
+}
+
+// Make a file's creation or rename durable
+void sync_directory(const std::string& path) {
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+} // namespace
+
+WalWriter::WalWriter(std::string path, size_t segment_size, WalDurability durability, bool direct)
+    : path_(std::move(path)),
+      segment_size_(direct ? round_up(segment_size, kBlockSize) : segment_size),
+      durability_(durability),
+      framed_(direct),
+      direct_io_(direct),
+      first_record_(kNoRecord) {
+    static_assert(kBlockSize == kFrameBlock, "framed blocks are the direct I/O unit");
+    if (framed_) {
+        for (auto& buffer : buffers_) {
+            buffer.reset(static_cast<char*>(std::aligned_alloc(kBlockSize, kBufferBlocks * kBlockSize)));
+            std::memset(buffer.get(), 0, kBufferBlocks * kBlockSize);
+        }
+        shadow_.reset(static_cast<char*>(std::aligned_alloc(kBlockSize, kBlockSize)));
+        io_thread_ = std::thread(&WalWriter::io_loop, this);
+    }
+}
+
+std::unique_ptr<WalWriter> WalWriter::open(const std::string& path, size_t segment_size, WalDurability durability,
+                                           bool direct) {
+    // Appending in the other format would leave a file that reads as neither; a segmented
+    // log always continues in a fresh segment, and each segment is read by its own format
+    if (segment_size == 0 && other_format(path, direct)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<WalWriter> writer(new WalWriter(path, segment_size, durability, direct));
+    if (segment_size == 0 && direct) {
+        // Positioned writes from the block after the existing ones (O_APPEND would ignore offsets)
+        writer->fd_ = writer->open_log(path, O_WRONLY | O_CREAT);
+        struct stat st;
+        if (writer->fd_ < 0 || fstat(writer->fd_, &st) != 0) {
+            return nullptr;
+        }
+        writer->offset_ = round_up(st.st_size, kBlockSize);
+        return writer;
+    }
+    if (segment_size == 0) {
+        writer->fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        return writer->fd_ < 0 ? nullptr : std::move(writer);
+    }
+
+    // Continue after the last segment with records; empty ones after it are spares
+    std::vector<uint64_t> numbers = segment_numbers(path);
+    uint64_t resume = 0;
+    for (uint64_t number : numbers) {
+        if (has_records(segment_name(path, number))) {
+            resume = number;
+        }
+    }
+    writer->first_ = numbers.empty() ? 1 : numbers.front();
+    writer->last_ = numbers.empty() ? 0 : numbers.back();
+    writer->current_ = resume > 0 ? resume : writer->first_ - 1;
+    if (!writer->open_next_segment()) {
+        return nullptr;
+    }
+    writer->prepare_segments();
+    return writer;
+}
+
+std::vector<std::string> WalWriter::files(const std::string& path) {
+    std::vector<std::string> files;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        files.push_back(path);
+    }
+    for (uint64_t number : segment_numbers(path)) {
+        files.push_back(segment_name(path, number));
+    }
+    return files;
+}
+
+WalWriter::~WalWriter() {
+    if (framed_) {
+        flush_blocks();
+        {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            io_stop_ = true;
+        }
+        io_cv_.notify_all();
+        io_thread_.join();
+    } else {
+        write_buffer();
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+int WalWriter::open_log(const std::string& path, int flags) {
+    if (direct_io_) {
+        int fd = ::open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, 0644);
+        if (fd >= 0 || errno != EINVAL) {
+            return fd;
+        }
+        direct_io_ = false; // The filesystem does not support O_DIRECT
+    }
+    return ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+}
+
+bool WalWriter::append(std::initializer_list<std::string_view> parts) {
+    size_t size = 0;
+    for (std::string_view part : parts) {
+        size += part.size();
+    }
+    segment_used_ = true;
+    if (framed_) {
+        return append_framed(parts, size);
+    }
+
+    // A Buffered log writes at most a segment at a time, so a batch never overruns one
+    size_t limit = segment_size_ > 0 ? std::min(kBufferSize, segment_size_) : kBufferSize;
+    bool rolled = false;
+    if (!buffer_.empty() && buffer_.size() + size > limit) {
+        rolled = write_buffer();
+    }
+    for (std::string_view part : parts) {
+        buffer_.append(part.data(), part.size());
+    }
+    if (durability_ != WalDurability::Buffered || buffer_.size() >= limit) {
+        rolled = write_buffer() || rolled;
+    }
+    return rolled;
+}
+
+void WalWriter::flush() {
+    if (framed_) {
+        flush_blocks();
+    } else {
+        write_buffer();
+    }
+}
+
+void WalWriter::commit() {
+    if (!framed_ || durability_ == WalDurability::Buffered) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(io_mutex_);
+    uint64_t target = appended_;
+    io_cv_.wait(lock, [&] { return written_ >= target; });
+}
+
+uint64_t WalWriter::roll() {
+    if (segment_size_ == 0) {
+        return 0;
+    }
+    flush();
+    if (segment_used_) {
+        open_next_segment();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return current_;
+}
+
+bool WalWriter::needs_segments() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segment_size_ > 0 && last_ - current_ < kSpareSegments;
+}
+
+void WalWriter::prepare_segments() {
+    std::lock_guard<std::mutex> maintenance(maintenance_mutex_);
+    const std::string temp_path = path_ + ".prepare";
+    while (needs_segments()) {
+        if (!preallocate(temp_path, segment_size_)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!publish_segment(temp_path)) {
+            unlink(temp_path.c_str());
+            return;
+        }
+    }
+    sync_directory(path_);
+}
+
+void WalWriter::recycle(uint64_t first_kept) {
+    if (segment_size_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> maintenance(maintenance_mutex_);
+    std::vector<uint64_t> covered;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        first_kept = std::min(first_kept, current_);
+        for (uint64_t number = first_; number < first_kept; ++number) {
+            covered.push_back(number);
+        }
+        first_ = std::max(first_, first_kept);
+    }
+
+    // Each leaves the series before it is zeroed, so a crash cannot expose half-cleared records
+    const std::string temp_path = path_ + ".recycle";
+    for (uint64_t number : covered) {
+        std::string name = segment_name(path_, number);
+        if (!needs_segments() || std::rename(name.c_str(), temp_path.c_str()) != 0) {
+            unlink(name.c_str());
+            continue;
+        }
+        bool reused = zero_fill(temp_path, segment_size_);
+        if (reused) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reused = publish_segment(temp_path);
+        }
+        if (!reused) {
+            unlink(temp_path.c_str());
+        }
+    }
+    sync_directory(path_);
+}
+
+bool WalWriter::publish_segment(const std::string& temp_path) {
+    if (std::rename(temp_path.c_str(), segment_name(path_, last_ + 1).c_str()) != 0) {
+        return false;
+    }
+    last_++;
+    return true;
+}
+
+bool WalWriter::write_buffer() {
+    if (buffer_.empty()) {
+        return false;
+    }
+    bool rolled = false;
+    if (segment_size_ > 0 && offset_ > 0 && offset_ + buffer_.size() > segment_size_) {
+        open_next_segment();
+        rolled = true;
+    }
+    // A record larger than a whole segment still goes in, growing that segment
+    if (fd_ >= 0 && write_all(fd_, buffer_.data(), buffer_.size(), offset_, segment_size_ > 0)) {
+        offset_ += buffer_.size();
+        if (durability_ == WalDurability::Sync && fdatasync(fd_) != 0) {
+            failed_ = true;
+        }
+    } else {
+        failed_ = true; // The records are dropped; later ones still get their chance
+    }
+    buffer_.clear();
+    return rolled;
+}
+
+bool WalWriter::open_next_segment() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+
+    uint64_t next;
+    bool ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        next = current_ + 1;
+        ready = next <= last_;
+    }
+    if (!ready) {
+        // No spare yet: create one here, on the write path
+        const std::string temp_path = path_ + ".roll";
+        if (!preallocate(temp_path, segment_size_)) {
+            failed_ = true;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!publish_segment(temp_path)) {
+            unlink(temp_path.c_str());
+            failed_ = true;
+            return false;
+        }
+        sync_directory(path_);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_ = next;
+    }
+    {
+        // The I/O thread is idle here: every record so far has been written out
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        offset_ = 0;
+        blocks_ready_ = 0;
+        fill_ = 0;
+        first_record_ = kNoRecord;
+        image_offset_ = UINT64_MAX;
+        fd_ = open_log(segment_name(path_, next), O_WRONLY);
+    }
+    segment_used_ = false;
+    if (fd_ < 0) {
+        failed_ = true;
+        return false;
+    }
+    write_segment_header();
+    return true;
+}
+
+void WalWriter::write_segment_header() {
+    if (framed_) {
+        // Written out with the segment's first records
+        std::unique_lock<std::mutex> lock(io_mutex_);
+        for (const std::string& record : segment_header_) {
+            put_record(lock, {record});
+        }
+        return;
+    }
+    std::string header;
+    for (const std::string& record : segment_header_) {
+        header += record;
+    }
+    if (header.empty()) {
+        return;
+    }
+    if (write_all(fd_, header.data(), header.size(), 0, true)) {
+        offset_ = header.size();
+    } else {
+        failed_ = true;
+    }
+}
+
+bool WalWriter::append_framed(std::initializer_list<std::string_view> parts, size_t size) {
+    std::unique_lock<std::mutex> lock(io_mutex_);
+
+    // Start a new segment rather than let the record cross into one (or into the block
+    // kept for the shadow of the segment's last one)
+    bool rolled = false;
+    if (segment_size_ > 0 && (offset_ > 0 || blocks_ready_ > 0 || fill_ > 0)) {
+        size_t last_block = (blocks_ready_ * kFramePayload + fill_ + size - 1) / kFramePayload;
+        if (offset_ + (last_block + 2) * kBlockSize > segment_size_) {
+            lock.unlock();
+            flush_blocks();
+            open_next_segment();
+            lock.lock();
+            rolled = true;
+        }
+    }
+
+    put_record(lock, parts);
+    if (durability_ != WalDurability::Buffered) {
+        // Written by the I/O thread; the caller waits for it in commit()
+        requested_ = appended_;
+        io_cv_.notify_all();
+    }
+    return rolled;
+}
+
+void WalWriter::put_record(std::unique_lock<std::mutex>& lock, std::initializer_list<std::string_view> parts) {
+    if (fill_ == kFramePayload) {
+        finish_block(lock);
+    }
+    if (first_record_ == kNoRecord) {
+        first_record_ = static_cast<uint16_t>(fill_);
+    }
+    for (std::string_view part : parts) {
+        put_bytes(lock, part.data(), part.size());
+    }
+    appended_++;
+}
+
+void WalWriter::put_bytes(std::unique_lock<std::mutex>& lock, const char* data, size_t size) {
+    while (size > 0) {
+        if (fill_ == kFramePayload) {
+            finish_block(lock);
+        }
+        size_t copied = std::min(size, kFramePayload - fill_);
+        std::memcpy(block(blocks_ready_) + kFrameHeader + fill_, data, copied);
+        fill_ += copied;
+        data += copied;
+        size -= copied;
+    }
+}
+
+void WalWriter::finish_block(std::unique_lock<std::mutex>& lock) {
+    seal_block(block(blocks_ready_), fill_, first_record_);
+    blocks_ready_++;
+    fill_ = 0;
+    first_record_ = kNoRecord;
+    if (blocks_ready_ == kBufferBlocks) {
+        // The I/O thread takes the full buffer as soon as it is done with the other one
+        io_cv_.notify_all();
+        io_cv_.wait(lock, [this] { return blocks_ready_ < kBufferBlocks; });
+    }
+}
+
+void WalWriter::flush_blocks() {
+    std::unique_lock<std::mutex> lock(io_mutex_);
+    uint64_t target = appended_;
+    requested_ = std::max(requested_, target);
+    io_cv_.notify_all();
+    io_cv_.wait(lock, [&] { return written_ >= target; });
+}
+
+void WalWriter::write_blocks(std::unique_lock<std::mutex>& lock) {
+    uint64_t target = appended_;
+    size_t blocks = blocks_ready_;
+    bool partial = fill_ > 0;
+    uint64_t base = offset_;
+    uint64_t partial_offset = base + blocks * kBlockSize;
+    char* data = buffers_[active_].get();
+    int fd = fd_;
+
+    // A block written before as a partial image must not be overwritten while it is the
+    // only intact copy of its records: its full image goes to its own place first (after
+    // a shadow copy if the latest image is there), and only then over the slot after it
+    bool completes = blocks > 0 && image_offset_ == base;
+    bool copy_first = completes && !image_shadow_;
+    if (copy_first) {
+        std::memcpy(shadow_.get(), data, kBlockSize);
+        uint16_t first_record;
+        std::memcpy(&first_record, data + 10, 2);
+        seal_block(shadow_.get(), kFramePayload, first_record, true);
+    }
+    bool shadow = partial && blocks == 0 && image_offset_ == partial_offset && !image_shadow_;
+    if (partial) {
+        // The partial block is sealed as it stands and continues at the front of the other buffer
+        seal_block(data + blocks * kBlockSize, fill_, first_record_, shadow);
+        std::memcpy(buffers_[active_ ^ 1].get(), data + blocks * kBlockSize, kBlockSize);
+    }
+    active_ ^= 1;
+    offset_ += blocks * kBlockSize;
+    blocks_ready_ = 0;
+    io_cv_.notify_all();
+    lock.unlock();
+
+    // Each step is synced under Sync, so the device sees them in order
+    bool written = fd >= 0;
+    auto write_step = [&](const char* from, size_t count, uint64_t at) {
+        written = written && write_all(fd, from, count * kBlockSize, at, true) &&
+                  (durability_ != WalDurability::Sync || fdatasync(fd) == 0);
+    };
+    if (copy_first) {
+        write_step(shadow_.get(), 1, base + kBlockSize);
+    }
+    size_t skip = completes ? 1 : 0;
+    if (completes) {
+        write_step(data, 1, base);
+    }
+    size_t count = blocks + (partial ? 1 : 0) - skip;
+    if (count > 0) {
+        write_step(data + skip * kBlockSize, count, shadow ? partial_offset + kBlockSize : base + skip * kBlockSize);
+    }
+    if (!written) {
+        failed_ = true;
+    }
+
+    lock.lock();
+    image_offset_ = partial ? partial_offset : UINT64_MAX;
+    image_shadow_ = shadow;
+    written_ = std::max(written_, target);
+    io_cv_.notify_all();
+}
+
+void WalWriter::io_loop() {
+    std::unique_lock<std::mutex> lock(io_mutex_);
+    while (true) {
+        io_cv_.wait(lock, [this] { return requested_ > written_ || blocks_ready_ == kBufferBlocks || io_stop_; });
+        if (requested_ <= written_ && blocks_ready_ < kBufferBlocks) {
+            return;
+        }
+        write_blocks(lock);
+    }
+}
+
+WalReader::WalReader(const std::string& path) : in_(path, std::ios::binary) {
+    uint32_t magic = 0;
+    framed_ = in_.read(reinterpret_cast<char*>(&magic), 4) && magic == kFrameMagic;
+    in_.clear();
+    in_.seekg(0);
+}
+
+bool WalReader::next(std::string& line) {
+    if (framed_) {
+        return next_framed(line);
+    }
+    if (in_.peek() == '\0' || !std::getline(in_, line) || line.find('\0') != std::string::npos) {
+        return false; // The unwritten tail of a segment, or a record running into it
+    }
+    position_ += line.size() + 1;
+    return true;
+}
+
+void WalReader::seek(uint64_t position) {
+    position_ = position;
+    if (!framed_) {
+        in_.clear();
+        in_.seekg(static_cast<std::streamoff>(position));
+    }
+}
+
+bool WalReader::next_framed(std::string& line) {
+    line.clear();
+    bool resync = false; // Lost track of record boundaries: start at a block's first record
+    while (true) {
+        uint64_t index = position_ / kFrameBlock;
+        size_t within = position_ % kFrameBlock;
+        if (!load_block(index)) {
+            return false;
+        }
+        if (!block_valid_) {
+            line.clear();
+            resync = true;
+            position_ = (index + 1) * kFrameBlock;
+            continue;
+        }
+        if (resync || (within < kFrameHeader && line.empty() && block_first_ != 0)) {
+            if (block_first_ == kNoRecord) {
+                position_ = (index + 1) * kFrameBlock;
+                continue;
+            }
+            within = kFrameHeader + block_first_;
+            resync = false;
+        } else if (within < kFrameHeader) {
+            within = kFrameHeader;
+        }
+
+        // Past the payload is padding; a record in progress continues in the next block
+        size_t end = kFrameHeader + block_length_;
+        if (within >= end) {
+            position_ = (index + 1) * kFrameBlock;
+            continue;
+        }
+        const char* begin = block_.data() + within;
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - within));
+        if (newline) {
+            line.append(begin, newline);
+            position_ = index * kFrameBlock + (newline - block_.data()) + 1;
+            return true;
+        }
+        line.append(begin, end - within);
+        position_ = (index + 1) * kFrameBlock;
+    }
+}
+
+bool WalReader::load_block(uint64_t index) {
+    if (index == block_index_) {
+        return true;
+    }
+    // The block and the one after it, which may hold a shadow image of it
+    block_.resize(2 * kFrameBlock);
+    in_.clear();
+    in_.seekg(static_cast<std::streamoff>(index * kFrameBlock));
+    in_.read(&block_[0], 2 * kFrameBlock);
+    size_t read = static_cast<size_t>(in_.gcount());
+    if (read < kFrameBlock) {
+        return false;
+    }
+
+    bool shadow;
+    block_valid_ = parse_block(block_.data(), block_length_, block_first_, shadow);
+    if (block_valid_ && shadow) {
+        block_valid_ = false; // An image of the block before, read with it
+        block_index_ = index;
+        return true;
+    }
+    size_t next_length;
+    uint16_t next_first;
+    bool next_shadow;
+    if (read == 2 * kFrameBlock && parse_block(block_.data() + kFrameBlock, next_length, next_first, next_shadow) &&
+        next_shadow && (!block_valid_ || next_length > block_length_)) {
+        std::memcpy(&block_[0], block_.data() + kFrameBlock, kFrameBlock);
+        block_valid_ = true;
+        block_length_ = next_length;
+        block_first_ = next_first;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, block_.data(), 4);
+    if (magic == 0) {
+        return false; // Never written: the end of the records
+    }
+    block_index_ = index;
+    return true;
+}
+
+} // namespace kvstore
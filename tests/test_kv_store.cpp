@@ -1,9 +1,25 @@
 #include "kv_store.hpp"
+#include "tenant_scheduler.hpp"
+#include "arena.hpp"
+#include "numa.hpp"
+#include "lz4.hpp"
+#include "key_filter.hpp"
+#include "mapped_table.hpp"
 #include <iostream>
 #include <cassert>
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <stdexcept>
+#include <future>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sched.h>
+#include <unistd.h>
 
 using namespace kvstore;
 
@@ -173,6 +189,1788 @@ void test_wal_recovery() {
     std::cout << "✓ test_wal_recovery passed" << std::endl;
 }
 
+// Test read-through loading with request coalescing
+void test_get_or_load() {
+    std::cout << "Running test_get_or_load..." << std::endl;
+    
+    KVStore store(100);
+    std::atomic<int> loads{0};
+    
+    auto loader = [&loads](const std::string& key) -> std::optional<std::string> {
+        loads++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return "loaded_" + key;
+    };
+    
+    // Concurrent misses on the same key run the loader exactly once
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&store, &loader]() {
+            auto result = store.get_or_load("hot", loader);
+            assert(result.has_value());
+            assert(result.value() == "loaded_hot");
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(loads == 1);
+    
+    // Loaded value was inserted via put, so later lookups hit the cache
+    assert(store.exists("hot"));
+    assert(store.get_or_load("hot", loader).value() == "loaded_hot");
+    assert(loads == 1);
+    
+    // Loader reporting absence inserts nothing
+    auto missing = store.get_or_load("missing", [](const std::string&) -> std::optional<std::string> {
+        return std::nullopt;
+    });
+    assert(!missing.has_value());
+    assert(!store.exists("missing"));
+    
+    // Loader exceptions propagate to the caller and leave no in-flight state behind
+    [[maybe_unused]] bool threw = false;
+    try {
+        store.get_or_load("broken", [](const std::string&) -> std::optional<std::string> {
+            throw std::runtime_error("backend down");
+        });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    assert(store.get_or_load("broken", loader).value() == "loaded_broken");
+    
+    std::cout << "✓ test_get_or_load passed" << std::endl;
+}
+
+// Test soft-TTL stale-while-revalidate and hard-TTL expiry
+void test_ttl_refresh() {
+    std::cout << "Running test_ttl_refresh..." << std::endl;
+    
+    KVStore store(100);
+    std::atomic<int> refreshes{0};
+    
+    store.set_refresher([&refreshes](const std::string& key) -> std::optional<std::string> {
+        refreshes++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return key + "_fresh";
+    });
+    
+    PutOptions options;
+    options.soft_ttl = std::chrono::milliseconds(20);
+    store.put("config", "config_stale", options);
+    
+    // Fresh entries do not trigger refreshes
+    assert(store.get("config").value() == "config_stale");
+    assert(refreshes == 0);
+    
+    // Stale entries are served immediately while a single refresh runs
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    for (int i = 0; i < 10; ++i) {
+        assert(store.get("config").value() == "config_stale");
+    }
+    
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    assert(refreshes == 1);
+    assert(store.get("config").value() == "config_fresh");
+    
+    // Entries past their hard TTL are gone
+    PutOptions expiring;
+    expiring.hard_ttl = std::chrono::milliseconds(20);
+    store.put("session", "token", expiring);
+    assert(store.exists("session"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    assert(!store.exists("session"));
+    assert(!store.get("session").has_value());
+    
+    std::cout << "✓ test_ttl_refresh passed" << std::endl;
+}
+
+// Test negative caching of keys a loader reported absent
+void test_negative_cache() {
+    std::cout << "Running test_negative_cache..." << std::endl;
+    
+    KVStore store(100);
+    store.set_negative_cache(2, std::chrono::milliseconds(50));
+    
+    int loads = 0;
+    auto absent_loader = [&loads](const std::string&) -> std::optional<std::string> {
+        loads++;
+        return std::nullopt;
+    };
+    
+    // Repeated lookups of a missing key hit the backend once
+    assert(!store.get_or_load("bogus", absent_loader).has_value());
+    assert(!store.get_or_load("bogus", absent_loader).has_value());
+    assert(loads == 1);
+    assert(!store.exists("bogus"));
+    
+    // Negative entries expire after their TTL
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    assert(!store.get_or_load("bogus", absent_loader).has_value());
+    assert(loads == 2);
+    
+    // Capacity is bounded: the oldest absent key is forgotten first
+    store.get_or_load("bogus2", absent_loader);
+    store.get_or_load("bogus3", absent_loader);
+    assert(loads == 4);
+    store.get_or_load("bogus", absent_loader);
+    assert(loads == 5);
+    
+    // A put of a negatively cached key makes it visible immediately
+    store.put("bogus3", "real");
+    assert(store.get_or_load("bogus3", absent_loader).value() == "real");
+    assert(loads == 5);
+    
+    std::cout << "✓ test_negative_cache passed" << std::endl;
+}
+
+// Test byte budget and GDSF cost/size-aware eviction
+void test_gdsf_eviction() {
+    std::cout << "Running test_gdsf_eviction..." << std::endl;
+    
+    StoreOptions options;
+    options.max_capacity = 1000;
+    options.max_bytes = 4096;
+    options.eviction_policy = EvictionPolicy::GDSF;
+    KVStore store(options);
+    
+    // Small entries that are expensive to re-fetch
+    PutOptions expensive;
+    expensive.cost = 100.0;
+    for (int i = 0; i < 5; ++i) {
+        store.put("small" + std::to_string(i), "v", expensive);
+    }
+    
+    // A large, cheap entry
+    store.put("large", std::string(2000, 'x'));
+    assert(store.memory_usage() <= 4096);
+    
+    // Another large entry forces eviction: the cheap large one goes, the small ones stay
+    store.put("large2", std::string(2000, 'y'));
+    assert(store.memory_usage() <= 4096);
+    assert(!store.exists("large"));
+    assert(store.exists("large2"));
+    for (int i = 0; i < 5; ++i) {
+        assert(store.exists("small" + std::to_string(i)));
+    }
+    
+    // Byte budget also applies under LRU, and deletes release bytes
+    KVStore lru(StoreOptions{1000, 1200, EvictionPolicy::LRU, ""});
+    lru.put("a", std::string(400, 'a'));
+    lru.put("b", std::string(400, 'b'));
+    lru.put("c", std::string(400, 'c'));
+    assert(!lru.exists("a"));
+    assert(lru.exists("b") && lru.exists("c"));
+    [[maybe_unused]] size_t used = lru.memory_usage();
+    lru.del("b");
+    assert(lru.memory_usage() < used);
+    
+    std::cout << "✓ test_gdsf_eviction passed" << std::endl;
+}
+
+// Test background eviction between low and high watermarks
+void test_background_eviction() {
+    std::cout << "Running test_background_eviction..." << std::endl;
+    
+    StoreOptions options;
+    options.max_capacity = 100;
+    options.background_eviction = true;
+    options.high_watermark = 0.9;
+    options.low_watermark = 0.5;
+    options.lazy_free_threshold = 1024;
+    KVStore store(options);
+    
+    // Below the high watermark nothing is evicted
+    for (int i = 0; i < 90; ++i) {
+        store.put("key" + std::to_string(i), "value");
+    }
+    assert(store.size() == 90);
+    
+    // Crossing it wakes the reclaimer, which evicts down to the low watermark
+    store.put("key90", "value");
+    for (int i = 0; i < 100 && store.size() > 50; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    assert(store.size() <= 50);
+    assert(store.exists("key90"));
+    assert(!store.exists("key0"));
+    
+    // The hard capacity still holds under a burst of inserts
+    for (int i = 0; i < 1000; ++i) {
+        store.put("burst" + std::to_string(i), "value");
+        assert(store.size() <= 100);
+    }
+    
+    // Large values are released through the background thread
+    store.put("big", std::string(4096, 'b'));
+    [[maybe_unused]] size_t used = store.memory_usage();
+    assert(store.del("big"));
+    assert(store.memory_usage() < used);
+    assert(!store.exists("big"));
+    
+    std::cout << "✓ test_background_eviction passed" << std::endl;
+}
+
+// Test that clear() and destruction of a large store hand teardown off the caller
+void test_async_clear() {
+    std::cout << "Running test_async_clear..." << std::endl;
+    
+    const int num_entries = 100000;
+    
+    {
+        KVStore store(num_entries);
+        for (int i = 0; i < num_entries; ++i) {
+            store.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        
+        store.clear();
+        assert(store.size() == 0);
+        assert(store.memory_usage() == 0);
+        assert(!store.exists("key0"));
+        
+        // The store is immediately usable while the old entries are torn down
+        store.put("key0", "fresh");
+        assert(store.get("key0").value() == "fresh");
+        
+        for (int i = 0; i < num_entries; ++i) {
+            store.put("key" + std::to_string(i), "value");
+        }
+        assert(store.size() == static_cast<size_t>(num_entries));
+    } // Destroyed with a full table
+    
+    // A dropped namespace's full table goes to the parent's worker, joined with the parent
+    {
+        KVStore parent(10);
+        StoreOptions options;
+        options.max_capacity = num_entries;
+        KVStore* keyspace = parent.create_namespace("big", options);
+        for (int i = 0; i < num_entries; ++i) {
+            keyspace->put("key" + std::to_string(i), "value");
+        }
+        assert(parent.drop_namespace("big"));
+        parent.put("key0", "value0");
+        assert(parent.get("key0").value() == "value0");
+    }
+    
+    std::cout << "✓ test_async_clear passed" << std::endl;
+}
+
+// Test namespaces with independent capacity, policy and WAL
+void test_namespaces() {
+    std::cout << "Running test_namespaces..." << std::endl;
+    
+    const std::string wal_path = "test_namespace_wal.log";
+    std::remove(wal_path.c_str());
+    
+    KVStore store(100);
+    
+    StoreOptions small;
+    small.max_capacity = 2;
+    KVStore* bulk = store.create_namespace("bulk", small);
+    assert(bulk != nullptr);
+    
+    StoreOptions durable;
+    durable.max_capacity = 100;
+    durable.eviction_policy = EvictionPolicy::GDSF;
+    durable.wal_path = wal_path;
+    durable.wal_durability = WalDurability::Buffered;
+    KVStore* sessions = store.create_namespace("sessions", durable);
+    assert(sessions != nullptr);
+    
+    // Names are unique and discoverable
+    assert(store.create_namespace("bulk", small) == nullptr);
+    assert(store.find_namespace("bulk") == bulk);
+    assert(store.find_namespace("missing") == nullptr);
+    assert(store.namespace_names().size() == 2);
+    
+    // Keyspaces are isolated from each other and from the default one
+    store.put("user", "default");
+    sessions->put("user", "session");
+    assert(store.get("user").value() == "default");
+    assert(sessions->get("user").value() == "session");
+    
+    // A noisy namespace only evicts its own keys
+    for (int i = 0; i < 50; ++i) {
+        bulk->put("bulk" + std::to_string(i), "value");
+    }
+    assert(bulk->size() == 2);
+    assert(sessions->exists("user"));
+    assert(store.exists("user"));
+    
+    // Dropping a namespace removes only it
+    assert(store.drop_namespace("bulk"));
+    assert(!store.drop_namespace("bulk"));
+    assert(store.find_namespace("bulk") == nullptr);
+    assert(sessions->get("user").value() == "session");
+    
+    // Each namespace writes its own WAL
+    assert(store.drop_namespace("sessions"));
+    KVStore recovered(100, wal_path);
+    recovered.recover();
+    assert(recovered.get("user").value() == "session");
+    std::remove(wal_path.c_str());
+    
+    std::cout << "✓ test_namespaces passed" << std::endl;
+}
+
+// Test per-tenant rate limits, memory quotas and weighted-fair scheduling
+void test_tenant_scheduler() {
+    std::cout << "Running test_tenant_scheduler..." << std::endl;
+    
+    KVStore store(100);
+    TenantScheduler scheduler(store, 1);
+    
+    TenantQuota bulk_quota;
+    bulk_quota.max_bytes = 2048;
+    assert(scheduler.add_tenant("bulk", bulk_quota));
+    
+    TenantQuota reader_quota;
+    reader_quota.max_ops_per_second = 1.0;
+    reader_quota.burst = 5;
+    assert(scheduler.add_tenant("reader", reader_quota));
+    assert(!scheduler.add_tenant("reader", reader_quota));
+    assert(scheduler.submit("nobody", [](KVStore&) {}) == SubmitStatus::UnknownTenant);
+    
+    // Hold the only worker so both queues fill up before anything runs
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    assert(scheduler.submit("bulk", [opened](KVStore&) { opened.wait(); }) == SubmitStatus::Accepted);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    
+    std::mutex order_mutex;
+    std::vector<std::string> order;
+    [[maybe_unused]] auto record = [&order_mutex, &order](const std::string& who) {
+        return [&order_mutex, &order, who](KVStore& keyspace) {
+            keyspace.put(who + std::to_string(order.size()), std::string(200, 'x'));
+            std::lock_guard<std::mutex> lock(order_mutex);
+            order.push_back(who);
+        };
+    };
+    
+    for (int i = 0; i < 50; ++i) {
+        assert(scheduler.submit("bulk", record("bulk")) == SubmitStatus::Accepted);
+    }
+    
+    // The reader's bucket admits its burst, then rate-limits
+    for (int i = 0; i < 5; ++i) {
+        assert(scheduler.submit("reader", record("reader")) == SubmitStatus::Accepted);
+    }
+    assert(scheduler.submit("reader", record("reader")) == SubmitStatus::RateLimited);
+    
+    gate.set_value();
+    scheduler.drain();
+    assert(order.size() == 55);
+    
+    // Equal weights alternate between backlogged tenants: readers are not stuck behind the bulk queue
+    [[maybe_unused]] size_t last_reader = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (order[i] == "reader") {
+            last_reader = i;
+        }
+    }
+    assert(last_reader < 12);
+    
+    // Memory quotas bound each tenant's namespace
+    assert(store.find_namespace("bulk")->memory_usage() <= 2048);
+    assert(store.find_namespace("reader")->size() == 5);
+    
+    std::cout << "✓ test_tenant_scheduler passed" << std::endl;
+}
+
+// Test hit/miss counters and sampled hot-key detection
+void test_hot_keys() {
+    std::cout << "Running test_hot_keys..." << std::endl;
+    
+    StoreOptions options;
+    options.max_capacity = 1000;
+    options.hot_key_capacity = 8;
+    options.hot_key_sample_rate = 4;
+    KVStore store(options);
+    
+    for (int i = 0; i < 500; ++i) {
+        store.put("key" + std::to_string(i), "value");
+    }
+    
+    // Skewed traffic: two celebrity keys among a long tail of cold ones
+    for (int round = 0; round < 400; ++round) {
+        store.get("key7");
+        store.get("key42");
+        store.get("key42");
+        store.get("key" + std::to_string(round));
+    }
+    store.get("nonexistent");
+    
+    StoreStats stats = store.stats(2);
+    assert(stats.entries == 500);
+    assert(stats.hits == 1600);
+    assert(stats.misses == 1);
+    assert(stats.hot_keys.size() == 2);
+    assert(stats.hot_keys[0].key == "key42");
+    assert(stats.hot_keys[1].key == "key7");
+    assert(stats.hot_keys[0].count >= 600);
+    
+    // Tracking can be turned off entirely
+    options.hot_key_capacity = 0;
+    KVStore untracked(options);
+    untracked.put("a", "b");
+    untracked.get("a");
+    assert(untracked.stats().hot_keys.empty());
+    
+    std::cout << "✓ test_hot_keys passed" << std::endl;
+}
+
+// Test per-core read replicas of hot keys and their invalidation on write
+void test_hot_key_replication() {
+    std::cout << "Running test_hot_key_replication..." << std::endl;
+    
+    StoreOptions options;
+    options.max_capacity = 1000;
+    options.hot_key_sample_rate = 1;
+    options.hot_key_replication = true;
+    options.replicated_hot_keys = 1;
+    KVStore store(options);
+    
+    store.put("celebrity", "v1");
+    for (int i = 0; i < 100; ++i) {
+        store.put("key" + std::to_string(i), "value");
+    }
+    
+    // Enough slow-path reads to promote the hot key into replicas
+    for (int i = 0; i < 2000; ++i) {
+        assert(store.get("celebrity").value() == "v1");
+    }
+    StoreStats before = store.stats();
+    
+    // Concurrent readers are served from replicas
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&store]() {
+            for (int i = 0; i < 1000; ++i) {
+                assert(store.get("celebrity").value() == "v1");
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    StoreStats after = store.stats();
+    assert(after.replica_hits >= before.replica_hits + 4000);
+    assert(after.hits == before.hits + 4000);
+    assert(store.stats(1).hot_keys[0].key == "celebrity");
+    
+    // Once it cools off, the replica moves to the key being read now
+    for (int i = 0; i < 8000; ++i) {
+        assert(store.get("key5").value() == "value");
+    }
+    [[maybe_unused]] uint64_t replica_hits = store.stats().replica_hits;
+    assert(store.get("celebrity").value() == "v1");
+    assert(store.stats().replica_hits == replica_hits);
+    assert(store.get("key5").value() == "value");
+    assert(store.stats().replica_hits == replica_hits + 1);
+    
+    // Writes invalidate replicas, so readers see the new value immediately
+    store.put("celebrity", "v2");
+    assert(store.get("celebrity").value() == "v2");
+    store.del("celebrity");
+    assert(!store.get("celebrity").has_value());
+    
+    // Other keys are unaffected
+    assert(store.get("key1").value() == "value");
+    
+    std::cout << "✓ test_hot_key_replication passed" << std::endl;
+}
+
+// Test the slab arena and NUMA-bound stores
+void test_numa_arena() {
+    std::cout << "Running test_numa_arena..." << std::endl;
+    
+    std::vector<int> node0_cpus = numa::node_cpus(0);
+    assert(!node0_cpus.empty());
+    
+    // Slab allocations are class-rounded and 16-byte aligned; large ones get their own mapping
+    Arena arena(ArenaOptions{0});
+    std::vector<std::pair<void*, size_t>> blocks;
+    for (size_t size : {1, 16, 17, 100, 1000, 5000, 100000}) {
+        for (int i = 0; i < 100; ++i) {
+            void* ptr = arena.allocate(size);
+            assert(reinterpret_cast<uintptr_t>(ptr) % 16 == 0);
+            std::memset(ptr, 0xab, size);
+            blocks.emplace_back(ptr, size);
+        }
+    }
+    assert(arena.allocated_bytes() >= 100 * (1 + 16 + 17 + 100 + 1000 + 5000 + 100000));
+    assert(arena.mapped_bytes() >= arena.allocated_bytes());
+    for (auto& block : blocks) {
+        arena.deallocate(block.first, block.second);
+    }
+    assert(arena.allocated_bytes() == 0);
+    
+    // A store bound to node 0 places its index and values in a node-local arena
+    StoreOptions options;
+    options.numa_node = 0;
+    KVStore store(options);
+    for (int i = 0; i < 1000; ++i) {
+        store.put("key" + std::to_string(i), std::string(i % 300, 'v'));
+    }
+    assert(store.get("key299").value() == std::string(299, 'v'));
+    
+    // Partitions on another node get their own arena and worker
+    StoreOptions unbound;
+    KVStore parent(unbound);
+    KVStore* partition = parent.create_namespace("node0", options);
+    partition->put("local", "value");
+    assert(partition->get("local").value() == "value");
+    
+    // Scheduler workers serving node-bound tenants run on that node's CPUs
+    TenantScheduler scheduler(parent, 2, 0);
+    scheduler.add_tenant("tenant", TenantQuota(), options);
+    std::atomic<int> off_node{0};
+    for (int i = 0; i < 20; ++i) {
+        scheduler.submit("tenant", [&node0_cpus, &off_node](KVStore& keyspace) {
+            keyspace.put("key", "value");
+            if (std::find(node0_cpus.begin(), node0_cpus.end(), sched_getcpu()) == node0_cpus.end()) {
+                off_node++;
+            }
+        });
+    }
+    scheduler.drain();
+    assert(off_node == 0);
+    
+    std::cout << "✓ test_numa_arena passed" << std::endl;
+}
+
+// Test huge page backed arenas
+void test_huge_pages() {
+    std::cout << "Running test_huge_pages..." << std::endl;
+    
+    const size_t huge = 2 * 1024 * 1024;
+    
+    // Slab pages become one huge page each, whether hugetlb pages are reserved or not
+    for (HugePages mode : {HugePages::Transparent, HugePages::Explicit}) {
+        Arena arena(ArenaOptions{-1, 256 * 1024, mode, huge});
+        std::vector<void*> small;
+        for (int i = 0; i < 1000; ++i) {
+            void* ptr = arena.allocate(64);
+            std::memset(ptr, 0xcd, 64);
+            small.push_back(ptr);
+        }
+        assert(arena.mapped_bytes() == huge);
+        
+        // Large allocations of a huge page or more are rounded to whole huge pages
+        void* large = arena.allocate(huge + 1);
+        std::memset(large, 0xcd, huge + 1);
+        assert(arena.mapped_bytes() == 3 * huge);
+        assert(arena.huge_page_bytes() % huge == 0);
+        assert(mode == HugePages::Explicit || arena.huge_page_bytes() == 0);
+        
+        arena.deallocate(large, huge + 1);
+        for (void* ptr : small) {
+            arena.deallocate(ptr, 64);
+        }
+        assert(arena.allocated_bytes() == 0);
+        assert(arena.mapped_bytes() == huge);
+    }
+    
+    // 1 GB pages do not inflate slab pages; only 2 MB and 1 GB pages are accepted
+    Arena giant(ArenaOptions{-1, 256 * 1024, HugePages::Explicit, 1024 * 1024 * 1024});
+    void* slot = giant.allocate(64);
+    assert(giant.mapped_bytes() == huge);
+    giant.deallocate(slot, 64);
+    [[maybe_unused]] bool rejected = false;
+    try {
+        Arena odd(ArenaOptions{-1, 256 * 1024, HugePages::Explicit, 3 * 1024 * 1024});
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    assert(rejected);
+    
+    // Slab pages are rounded up to a power of two, which page lookups rely on
+    Arena uneven(ArenaOptions{-1, 300 * 1024});
+    std::vector<void*> slots;
+    for (int i = 0; i < 10000; ++i) {
+        slots.push_back(uneven.allocate(100));
+    }
+    assert(uneven.mapped_bytes() % (512 * 1024) == 0);
+    for (void* ptr : slots) {
+        uneven.deallocate(ptr, 100);
+    }
+    assert(uneven.allocated_bytes() == 0);
+    
+    StoreOptions options;
+    options.huge_pages = HugePages::Explicit;
+    KVStore store(options);
+    for (int i = 0; i < 1000; ++i) {
+        store.put("key" + std::to_string(i), std::string(i % 300, 'v'));
+    }
+    assert(store.get("key299").value() == std::string(299, 'v'));
+    
+    // A namespace asking for different page backing gets its own arena
+    KVStore* plain = store.create_namespace("plain", StoreOptions());
+    plain->put("key", "value");
+    assert(plain->get("key").value() == "value");
+    
+    std::cout << "✓ test_huge_pages passed" << std::endl;
+}
+
+// Test active defrag of sparse arena pages
+void test_active_defrag() {
+    std::cout << "Running test_active_defrag..." << std::endl;
+    
+    // Relocation hints: only slots on pages sparser than their class average move
+    Arena arena;
+    std::vector<void*> slots;
+    for (int i = 0; i < 10000; ++i) {
+        slots.push_back(arena.allocate(200));
+    }
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (i < slots.size() / 2 && i % 4 != 0) {
+            arena.deallocate(slots[i], 200);
+            slots[i] = nullptr;
+        }
+    }
+    size_t movable = 0;
+    for (void*& slot : slots) {
+        if (slot && arena.should_relocate(slot, 200)) {
+            void* moved = arena.allocate(200);
+            arena.deallocate(slot, 200);
+            slot = moved;
+            movable++;
+        }
+    }
+    assert(movable > 0);
+    void* large = arena.allocate(100000);
+    assert(!arena.should_relocate(large, 100000));
+    arena.deallocate(large, 100000);
+    arena.trim();
+    size_t live = 0;
+    for (void* slot : slots) {
+        if (slot) {
+            arena.deallocate(slot, 200);
+            live++;
+        }
+    }
+    assert(live == 10000 - 5000 + 1250);
+    
+    // A store that deletes most of its keys compacts values and index nodes and hands the
+    // emptied pages back
+    StoreOptions options;
+    options.max_capacity = 40000;
+    options.eviction_policy = EvictionPolicy::GDSF;
+    options.active_defrag = true;
+    KVStore store(options);
+    for (int i = 0; i < 40000; ++i) {
+        store.put("key" + std::to_string(i), std::string(200, static_cast<char>('a' + i % 26)));
+    }
+    size_t mapped_before = store.stats().arena_mapped_bytes;
+    for (int i = 0; i < 40000; ++i) {
+        if (i % 8 != 0) {
+            store.del("key" + std::to_string(i));
+        }
+    }
+    
+    // Writes keep triggering checks; wait for the background passes to finish
+    for (int attempt = 0; attempt < 500 && store.stats().arena_mapped_bytes > mapped_before / 2; ++attempt) {
+        for (int i = 0; i < 100; ++i) {
+            store.put("trigger", "value");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    StoreStats stats = store.stats();
+    assert(stats.defrag_moves > 0);
+    assert(stats.arena_mapped_bytes <= mapped_before / 2);
+    for (int i = 0; i < 40000; i += 8) {
+        assert(store.get("key" + std::to_string(i)).value() == std::string(200, static_cast<char>('a' + i % 26)));
+    }
+    
+    // Moved GDSF queue entries still point at their keys, so evicting them works
+    for (int i = 0; i < 40000; ++i) {
+        store.put("new" + std::to_string(i), "value");
+    }
+    assert(store.size() == 40000);
+    assert(store.stats().evictions >= 5000);
+    
+    std::cout << "✓ test_active_defrag passed" << std::endl;
+}
+
+// Test the compressed cold tier
+void test_cold_tier() {
+    std::cout << "Running test_cold_tier..." << std::endl;
+    
+    // Codec round trips, including empty, tiny, repetitive and incompressible input
+    std::string random_bytes;
+    uint32_t seed = 12345;
+    for (int i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        random_bytes.push_back(static_cast<char>(seed >> 16));
+    }
+    std::string json;
+    for (int i = 0; i < 40; ++i) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"user\",\"active\":true},";
+    }
+    for (const std::string& input : {std::string(), std::string("abc"), std::string(100000, 'z'), json, random_bytes}) {
+        std::string compressed(lz4::compress_bound(input.size()), '\0');
+        [[maybe_unused]] size_t size = lz4::compress(input.data(), input.size(), &compressed[0], compressed.size());
+        assert(size > 0 && size <= compressed.size());
+        std::string output(input.size(), '\0');
+        assert(lz4::decompress(compressed.data(), size, &output[0], output.size()));
+        assert(output == input);
+        if (input.size() > 1) {
+            assert(!lz4::decompress(compressed.data(), size, &output[0], output.size() - 1));
+        }
+    }
+    std::string packed(lz4::compress_bound(json.size()), '\0');
+    assert(lz4::compress(json.data(), json.size(), &packed[0], packed.size()) < json.size() / 4);
+    
+    // The colder half of the store is kept compressed and charged at its compressed size
+    StoreOptions options;
+    options.compress_cold = true;
+    KVStore store(options);
+    for (int i = 0; i < 1000; ++i) {
+        store.put("key" + std::to_string(i), json + std::to_string(i));
+    }
+    StoreStats stats = store.stats();
+    assert(stats.cold_entries == 500);
+    assert(stats.cold_bytes_saved > 500 * json.size() / 2);
+    assert(stats.bytes < 1000 * (json.size() + 128) - stats.cold_bytes_saved / 2);
+    
+    // Reading a cold entry decompresses it and promotes it to the hot end
+    assert(store.get("key0").value() == json + "0");
+    assert(store.stats().cold_entries == 499);
+    store.put("key1", "small");
+    assert(store.get("key1").value() == "small");
+    assert(store.del("key2"));
+    assert(!store.get("key2").has_value());
+    for (int i = 3; i < 1000; ++i) {
+        assert(store.get("key" + std::to_string(i)).value() == json + std::to_string(i));
+    }
+    
+    // Cold entries are evicted first and the tier survives clear()
+    StoreOptions small = options;
+    small.max_capacity = 100;
+    KVStore bounded(small);
+    for (int i = 0; i < 300; ++i) {
+        bounded.put("key" + std::to_string(i), json);
+    }
+    assert(bounded.size() == 100);
+    assert(bounded.stats().cold_entries <= 50);
+    bounded.clear();
+    assert(bounded.stats().cold_entries == 0);
+    bounded.put("key", json);
+    assert(bounded.get("key").value() == json);
+    
+    std::cout << "✓ test_cold_tier passed" << std::endl;
+}
+
+// Test dictionary-trained value compression
+void test_dictionary_compression() {
+    std::cout << "Running test_dictionary_compression..." << std::endl;
+    
+    // Small records sharing structure but not repeating within themselves
+    auto record = [](int i) {
+        return "{\"user_id\":" + std::to_string(i * 7919) + ",\"display_name\":\"member-" + std::to_string(i) +
+               "\",\"preferences\":{\"theme\":\"dark\",\"language\":\"en-US\",\"notifications\":true}," +
+               "\"last_login_timestamp\":" + std::to_string(1700000000 + i) + "}";
+    };
+    
+    std::vector<std::string> samples;
+    for (int i = 0; i < 200; ++i) {
+        samples.push_back(record(i));
+    }
+    lz4::Dictionary dictionary(lz4::train_dictionary(samples, 4096));
+    assert(!dictionary.content().empty() && dictionary.content().size() <= 4096);
+    
+    std::string value = record(100000);
+    std::string plain(lz4::compress_bound(value.size()), '\0');
+    std::string with_dict(lz4::compress_bound(value.size()), '\0');
+    [[maybe_unused]] size_t plain_size = lz4::compress(value.data(), value.size(), &plain[0], plain.size());
+    [[maybe_unused]] size_t dict_size =
+        lz4::compress(value.data(), value.size(), &with_dict[0], with_dict.size(), &dictionary);
+    assert(dict_size < plain_size / 2);
+    std::string output(value.size(), '\0');
+    assert(lz4::decompress(with_dict.data(), dict_size, &output[0], output.size(), &dictionary));
+    assert(output == value);
+    assert(!lz4::decompress(with_dict.data(), dict_size, &output[0], output.size()));
+    
+    const std::string wal_path = "test_dictionary_wal.log";
+    std::remove(wal_path.c_str());
+    
+    StoreOptions options;
+    options.compress_values = true;
+    options.wal_path = wal_path;
+    {
+        KVStore store(options);
+        for (int i = 0; i < 200; ++i) {
+            store.put("key" + std::to_string(i), record(i));
+        }
+        [[maybe_unused]] size_t saved_before = store.stats().compressed_bytes_saved;
+        
+        assert(store.train_dictionary(4096) == 1);
+        assert(store.stats().dictionary_version == 1);
+        for (int i = 0; i < 200; ++i) {
+            store.put("key" + std::to_string(i), record(i));
+        }
+        assert(store.stats().compressed_bytes_saved > saved_before * 2);
+        
+        // Values written against version 1 stay readable after retraining
+        for (int i = 200; i < 210; ++i) {
+            store.put("key" + std::to_string(i), record(i));
+        }
+        assert(store.train_dictionary(4096) == 2);
+        store.put("new", record(500));
+        for (int i = 0; i < 210; ++i) {
+            assert(store.get("key" + std::to_string(i)).value() == record(i));
+        }
+        assert(store.get("new").value() == record(500));
+    }
+    
+    // The WAL carries compressed payloads and the dictionaries needed to decode them
+    {
+        KVStore recovered(options);
+        assert(recovered.recover());
+        assert(recovered.size() == 211);
+        assert(recovered.stats().dictionary_version == 2);
+        for (int i = 0; i < 210; ++i) {
+            assert(recovered.get("key" + std::to_string(i)).value() == record(i));
+        }
+        assert(recovered.get("new").value() == record(500));
+    }
+    std::remove(wal_path.c_str());
+    
+    // A store reopened without recovering numbers its first dictionary 1 again; each
+    // record decodes against the version 1 logged before it, not the last one
+    auto other = [](int i) {
+        return "<order id='" + std::to_string(i * 104729) + "' status='shipped' carrier='parcel-" +
+               std::to_string(i % 7) + "' weight='" + std::to_string(i % 50) + ".5kg'/>";
+    };
+    {
+        KVStore store(options);
+        for (int i = 0; i < 200; ++i) {
+            store.put("first" + std::to_string(i), record(i));
+        }
+        assert(store.train_dictionary(4096) == 1);
+        store.put("early", record(1000));
+    }
+    {
+        KVStore store(options);
+        for (int i = 0; i < 200; ++i) {
+            store.put("second" + std::to_string(i), other(i));
+        }
+        assert(store.train_dictionary(4096) == 1);
+        store.put("late", other(1000));
+    }
+    {
+        KVStore recovered(options);
+        assert(recovered.recover_async());
+        assert(recovered.get("early").value() == record(1000));
+        assert(recovered.get("late").value() == other(1000));
+    }
+    {
+        KVStore recovered(options);
+        assert(recovered.recover());
+        assert(recovered.get("early").value() == record(1000));
+        assert(recovered.get("late").value() == other(1000));
+    }
+    std::remove(wal_path.c_str());
+    
+    std::cout << "✓ test_dictionary_compression passed" << std::endl;
+}
+
+// Test inline storage of short keys and values
+void test_inline_storage() {
+    std::cout << "Running test_inline_storage..." << std::endl;
+    
+    Arena arena;
+    ArenaBuffer empty;
+    assert(empty.size() == 0 && empty.is_inline());
+    
+    std::string short_text(ArenaBuffer::kInlineCapacity, 's');
+    std::string long_text(ArenaBuffer::kInlineCapacity + 1, 'l');
+    ArenaBuffer inline_buffer(arena, short_text.data(), short_text.size());
+    ArenaBuffer heap_buffer(arena, long_text.data(), long_text.size());
+    assert(inline_buffer.is_inline() && inline_buffer.str() == short_text);
+    assert(!heap_buffer.is_inline() && heap_buffer.str() == long_text);
+    assert(arena.allocated_bytes() > 0);
+    
+    // Moves carry inline bytes and out-of-line pointers alike
+    ArenaBuffer moved_inline = std::move(inline_buffer);
+    ArenaBuffer moved_heap = std::move(heap_buffer);
+    assert(moved_inline.str() == short_text && inline_buffer.size() == 0);
+    assert(moved_heap.str() == long_text && heap_buffer.size() == 0);
+    
+    // Borrowed buffers compare and hash like owned ones and never free
+    ArenaBuffer borrowed = ArenaBuffer::borrow(long_text.data(), long_text.size());
+    assert(borrowed == moved_heap);
+    assert(ArenaBufferHash()(borrowed) == ArenaBufferHash()(moved_heap));
+    assert(ArenaBufferHash()(moved_inline) == std::hash<std::string_view>()(short_text));
+    moved_heap.reset();
+    assert(arena.allocated_bytes() == 0);
+    
+    // Short keys and values need no allocation beyond the index nodes
+    StoreOptions options;
+    options.max_capacity = 100000;
+    KVStore store(options);
+    for (int i = 0; i < 10000; ++i) {
+        store.put("user:session:" + std::to_string(i), "v" + std::to_string(i));
+    }
+    assert(store.stats().arena_allocated_bytes < 10000 * 256);
+    
+    // Keys and values on either side of the inline limit behave the same
+    for (size_t size : {size_t(0), size_t(1), size_t(22), size_t(23), size_t(24), size_t(100)}) {
+        std::string key = "k" + std::string(size, 'k');
+        std::string value(size, 'v');
+        store.put(key, value);
+        assert(store.get(key).value() == value);
+        store.put(key, value + "!");
+        assert(store.get(key).value() == value + "!");
+        assert(store.del(key));
+        assert(!store.exists(key));
+    }
+    
+    std::cout << "✓ test_inline_storage passed" << std::endl;
+}
+
+// Test value dedup
+void test_value_dedup() {
+    std::cout << "Running test_value_dedup..." << std::endl;
+    
+    StoreOptions options;
+    options.max_capacity = 1000;
+    options.dedup_values = true;
+    KVStore store(options);
+    
+    std::string shared(1000, 'd');
+    for (int i = 0; i < 100; ++i) {
+        store.put("key" + std::to_string(i), shared);
+    }
+    StoreStats stats = store.stats();
+    assert(stats.shared_values == 1);
+    assert(stats.dedup_bytes_saved == 99 * shared.size());
+    assert(stats.bytes < 100 * 200); // One copy, not a hundred
+    assert(store.get("key42").value() == shared);
+    
+    // Values equal in length but not content are kept apart
+    std::string other(1000, 'e');
+    store.put("key0", other);
+    assert(store.stats().shared_values == 2);
+    assert(store.get("key0").value() == other);
+    assert(store.get("key1").value() == shared);
+    
+    // The pooled copy lives until its last reference goes
+    for (int i = 1; i < 100; ++i) {
+        assert(store.del("key" + std::to_string(i)));
+    }
+    stats = store.stats();
+    assert(stats.shared_values == 1 && stats.dedup_bytes_saved == 0);
+    assert(store.get("key0").value() == other);
+    assert(store.del("key0"));
+    assert(store.stats().shared_values == 0 && store.stats().bytes == 0);
+    
+    // Short values stay inline, and dedup composes with compression
+    store.put("short", "tiny");
+    assert(store.stats().shared_values == 0);
+    StoreOptions compressed = options;
+    compressed.compress_values = true;
+    KVStore compressing(compressed);
+    std::string text;
+    for (int i = 0; i < 40; ++i) {
+        text += "field" + std::to_string(i) + "=value;";
+    }
+    compressing.put("a", text);
+    compressing.put("b", text);
+    assert(compressing.stats().shared_values == 1);
+    assert(compressing.stats().compressed_bytes_saved > 0);
+    assert(compressing.get("b").value() == text);
+    compressing.clear();
+    assert(compressing.stats().shared_values == 0);
+    
+    std::cout << "✓ test_value_dedup passed" << std::endl;
+}
+
+// Test fingerprint-indexed keys
+void test_fingerprint_keys() {
+    std::cout << "Running test_fingerprint_keys..." << std::endl;
+    
+    auto key_of = [](int i) {
+        return "tenant:0042:user:session:token:" + std::to_string(1000000 + i);
+    };
+    
+    StoreOptions full;
+    full.max_capacity = 100000;
+    StoreOptions fingerprinted = full;
+    fingerprinted.fingerprint_keys = true;
+    KVStore full_store(full);
+    KVStore fingerprint_store(fingerprinted);
+    for (int i = 0; i < 10000; ++i) {
+        full_store.put(key_of(i), "v");
+        fingerprint_store.put(key_of(i), "v");
+    }
+    
+    // 40-byte keys no longer take an allocation of their own
+    assert(fingerprint_store.stats().arena_allocated_bytes < full_store.stats().arena_allocated_bytes);
+    assert(fingerprint_store.stats().bytes < full_store.stats().bytes);
+    assert(fingerprint_store.size() == 10000);
+    assert(fingerprint_store.get(key_of(123)).value() == "v");
+    assert(!fingerprint_store.exists(key_of(10000)));
+    assert(fingerprint_store.del(key_of(123)));
+    assert(!fingerprint_store.get(key_of(123)).has_value());
+    
+    // With a checksum, WAL recovery and hot-key replicas work from the original keys
+    const std::string wal_path = "test_fingerprint_wal.log";
+    std::remove(wal_path.c_str());
+    StoreOptions checked = fingerprinted;
+    checked.fingerprint_checksum = true;
+    checked.wal_path = wal_path;
+    checked.hot_key_sample_rate = 1;
+    checked.hot_key_replication = true;
+    checked.replicated_hot_keys = 1;
+    {
+        KVStore store(checked);
+        store.put("celebrity", "v1");
+        store.put("other", "value");
+        for (int i = 0; i < 2000; ++i) {
+            assert(store.get("celebrity").value() == "v1");
+        }
+        assert(store.stats().replica_hits > 0);
+        store.put("celebrity", "v2");
+        assert(store.get("celebrity").value() == "v2");
+        assert(store.stats(1).hot_keys[0].key == "celebrity");
+    }
+    KVStore recovered(checked);
+    recovered.recover();
+    assert(recovered.get("celebrity").value() == "v2");
+    assert(recovered.get("other").value() == "value");
+    std::remove(wal_path.c_str());
+    
+    std::cout << "✓ test_fingerprint_keys passed" << std::endl;
+}
+
+// Test the key filter in front of the index
+void test_key_filter() {
+    std::cout << "Running test_key_filter..." << std::endl;
+    
+    KeyFilter filter(10000);
+    std::hash<std::string> hash;
+    for (int i = 0; i < 10000; ++i) {
+        filter.add(hash("present" + std::to_string(i)));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        assert(filter.may_contain(hash("present" + std::to_string(i))));
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 10000; ++i) {
+        false_positives += filter.may_contain(hash("absent" + std::to_string(i)));
+    }
+    assert(false_positives < 300);
+    
+    // Removing keys never hides the ones still present
+    for (int i = 0; i < 5000; ++i) {
+        filter.remove(hash("present" + std::to_string(i)));
+    }
+    for (int i = 5000; i < 10000; ++i) {
+        assert(filter.may_contain(hash("present" + std::to_string(i))));
+    }
+    filter.clear();
+    assert(!filter.may_contain(hash("present9999")));
+    
+    // Blocks dropped by clear() start from zero when reused; old counts do not come back
+    for (int i = 0; i < 100; ++i) {
+        filter.add(hash("again" + std::to_string(i)));
+    }
+    for (int i = 0; i < 100; ++i) {
+        assert(filter.may_contain(hash("again" + std::to_string(i))));
+    }
+    false_positives = 0;
+    for (int i = 5000; i < 10000; ++i) {
+        false_positives += filter.may_contain(hash("present" + std::to_string(i)));
+    }
+    assert(false_positives < 150);
+    
+    StoreOptions options;
+    options.max_capacity = 1000;
+    options.key_filter = true;
+    KVStore store(options);
+    for (int i = 0; i < 1000; ++i) {
+        store.put("key" + std::to_string(i), "value");
+    }
+    
+    // Misses on keys never stored skip the lock but still count as misses
+    for (int i = 0; i < 1000; ++i) {
+        assert(!store.get("never" + std::to_string(i)).has_value());
+        assert(!store.exists("never" + std::to_string(i)));
+    }
+    StoreStats stats = store.stats();
+    assert(stats.filtered_misses > 1900);
+    assert(stats.misses >= 1000 && stats.misses <= stats.filtered_misses + 1000);
+    assert(store.get("key7").value() == "value");
+    
+    // Deletes, evictions and clear() drop keys from the filter
+    assert(store.del("key7"));
+    assert(!store.exists("key7"));
+    for (int i = 1000; i < 2000; ++i) {
+        store.put("key" + std::to_string(i), "value");
+    }
+    [[maybe_unused]] uint64_t before = store.stats().filtered_misses;
+    for (int i = 0; i < 1000; ++i) {
+        assert(!store.exists("key" + std::to_string(i)));
+    }
+    assert(store.stats().filtered_misses > before + 900);
+    store.clear();
+    assert(!store.get("key1500").has_value());
+    
+    // Lock-free negative reads race safely with writers
+    std::thread writer([&store]() {
+        for (int i = 0; i < 5000; ++i) {
+            store.put("race" + std::to_string(i), "value");
+        }
+    });
+    for (int i = 0; i < 5000; ++i) {
+        store.get("race" + std::to_string(i));
+    }
+    writer.join();
+    assert(store.get("race4999").value() == "value");
+    
+    std::cout << "✓ test_key_filter passed" << std::endl;
+}
+
+// Test the shared-memory table published for other processes
+void test_shared_memory() {
+    std::cout << "Running test_shared_memory..." << std::endl;
+    
+    const std::string name = "/kvstore_test_" + std::to_string(getpid());
+    StoreOptions options;
+    options.max_capacity = 100;
+    options.shared_memory_name = name;
+    options.shared_memory_slots = 1024;
+    options.shared_memory_slot_size = 128;
+    auto store = std::make_unique<KVStore>(options);
+    
+    // A reader maps the region on its own, as another process would
+    auto reader = MappedTable::open_shared(name);
+    assert(reader && !reader->closed());
+    store->put("key1", "value1");
+    store->put("key2", "value2");
+    assert(reader->get("key1").value() == "value1");
+    assert(!reader->get("missing").has_value());
+    
+    // Updates, deletes and evictions are visible without any call into the store
+    store->put("key1", "updated");
+    assert(reader->get("key1").value() == "updated");
+    assert(store->del("key2"));
+    assert(!reader->get("key2").has_value());
+    for (int i = 0; i < 200; ++i) {
+        store->put("fill" + std::to_string(i), "value");
+    }
+    assert(!reader->get("key1").has_value());
+    assert(reader->get("fill199").value() == "value");
+    assert(store->stats().shared_memory_entries == 100);
+    
+    // Oversized entries stay private; hard TTLs expire for readers too
+    store->put("big", std::string(200, 'b'));
+    assert(store->get("big").has_value() && !reader->get("big").has_value());
+    PutOptions ttl;
+    ttl.hard_ttl = std::chrono::milliseconds(20);
+    store->put("short-lived", "value", ttl);
+    assert(reader->get("short-lived").has_value());
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    assert(!reader->get("short-lived").has_value());
+    
+    // Lock-free readers never see a torn value while the writer rewrites it
+    std::atomic<bool> done{false};
+    std::thread checker([&]() {
+        while (!done.load()) {
+            auto value = reader->get("hot");
+            if (value) {
+                assert(value->size() == 64);
+                assert(std::count(value->begin(), value->end(), (*value)[0]) == 64);
+            }
+        }
+    });
+    for (int i = 0; i < 20000; ++i) {
+        store->put("hot", std::string(64, static_cast<char>('a' + i % 26)));
+    }
+    done = true;
+    checker.join();
+    
+    store->clear();
+    assert(reader->size() == 0 && !reader->get("hot").has_value());
+    store.reset();
+    assert(reader->closed());
+    assert(!MappedTable::open_shared(name));
+    
+    std::cout << "✓ test_shared_memory passed" << std::endl;
+}
+
+// Test the persistent mapped file: O(1) reopen, fault-in and torn records
+void test_persistent_table() {
+    std::cout << "Running test_persistent_table..." << std::endl;
+    
+    const std::string path = "test_persistent.map";
+    std::remove(path.c_str());
+    StoreOptions options;
+    options.max_capacity = 100;
+    options.persistent_path = path;
+    options.persistent_slots = 4096;
+    options.persistent_slot_size = 128;
+    
+    {
+        KVStore store(options);
+        for (int i = 0; i < 500; ++i) {
+            store.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        
+        // Evicted entries stay in the file and fault back in
+        assert(store.size() == 100);
+        assert(store.get("key0").value() == "value0");
+        assert(store.exists("key1"));
+        assert(store.stats().persistent_faults == 1);
+        assert(store.del("key2"));
+        assert(!store.get("key2").has_value());
+        store.put("key3", "updated");
+        
+        // An entry too large for a slot is reported, kept in memory and not faulted back in
+        assert(!store.put("large", std::string(200, 'l')));
+        assert(store.stats().persistent_write_failures == 1);
+        assert(store.get("large").value() == std::string(200, 'l'));
+        
+        PutOptions ttl;
+        ttl.hard_ttl = std::chrono::milliseconds(30);
+        store.put("short-lived", "value", ttl);
+        
+        // One writer per file
+        assert(!MappedTable::open_file(path, 4096, 128, false));
+        
+        // A snapshot would miss the entries living only in the file
+        assert(!store.snapshot("test_persistent.snap").get());
+        assert(!std::ifstream("test_persistent.snap").is_open());
+    }
+    
+    // Reopening replays nothing and serves every key straight away
+    {
+        KVStore store(options);
+        assert(store.size() == 0);
+        assert(store.stats().persistent_entries == 500);
+        assert(store.get("key499").value() == "value499");
+        assert(store.get("key3").value() == "updated");
+        assert(!store.get("key2").has_value());
+        assert(!store.get("large").has_value());
+        assert(store.get("short-lived").has_value());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(!store.get("short-lived").has_value());
+    }
+    
+    // A record damaged on disk (as a crash mid-write would leave it) reads as absent, not garbage
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        size_t offset = contents.find("key42value42");
+        assert(offset != std::string::npos);
+        file.seekp(offset + 6);
+        file.put('X');
+    }
+    {
+        KVStore store(options);
+        assert(!store.get("key42").has_value());
+        assert(store.get("key43").value() == "value43");
+        store.put("key42", "rewritten");
+        assert(store.get("key42").value() == "rewritten");
+        store.clear();
+        assert(!store.get("key43").has_value());
+        
+        // Cleared slots are reused without being wiped first
+        for (int i = 0; i < 500; ++i) {
+            assert(store.put("again" + std::to_string(i), "value" + std::to_string(i)));
+        }
+        store.put("key43", "after clear");
+    }
+    
+    // The clear survives a reopen and later writes are kept
+    {
+        KVStore store(options);
+        assert(store.stats().persistent_entries == 501);
+        assert(!store.get("key0").has_value());
+        assert(!store.get("key42").has_value());
+        assert(store.get("key43").value() == "after clear");
+        assert(store.get("again499").value() == "value499");
+    }
+    std::remove(path.c_str());
+    
+    // With every slot of a key's probe window live, an update has nowhere to put its new
+    // copy: it is refused and the old value retired, never rewritten in place
+    {
+        auto table = MappedTable::open_file(path, 64, 128, false);
+        assert(table);
+        for (int i = 0; i < 64; ++i) {
+            assert(table->put("t" + std::to_string(i), "old"));
+        }
+        assert(!table->put("t0", "new"));
+        assert(!table->get("t0").has_value());
+        assert(table->get("t1").value() == "old");
+        assert(table->put("t0", "new"));
+        assert(table->get("t0").value() == "new");
+    }
+    std::remove(path.c_str());
+    
+    std::cout << "✓ test_persistent_table passed" << std::endl;
+}
+
+// Test serving requests while the WAL replays in the background
+void test_progressive_recovery() {
+    std::cout << "Running test_progressive_recovery..." << std::endl;
+    
+    const std::string wal_path = "test_progressive.log";
+    std::remove(wal_path.c_str());
+    
+    {
+        KVStore store(100000, wal_path);
+        store.put("gone", "value");
+        store.clear();
+        for (int i = 0; i < 20000; ++i) {
+            store.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        store.put("key1", "updated");
+        store.del("key2");
+    }
+    
+    KVStore store(100000, wal_path);
+    
+    // The index pass does not hold the lock, so reads go on while it scans and see either
+    // the store as it was or the installed index
+    std::atomic<bool> indexed{false};
+    std::thread reader([&] {
+        while (!indexed) {
+            std::optional<std::string> value = store.get("key5");
+            assert(!value || *value == "value5");
+        }
+    });
+    assert(store.recover_async());
+    indexed = true;
+    reader.join();
+    
+    // Any key is served at once, whether or not the replay has reached it
+    assert(store.get("key19999").value() == "value19999");
+    assert(store.get("key1").value() == "updated");
+    assert(!store.exists("key2"));
+    assert(store.exists("key5"));
+    assert(!store.get("gone").has_value());
+    
+    // Writes made meanwhile win over the log
+    store.put("key7", "live");
+    assert(store.del("key8"));
+    
+    while (store.recovering()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(store.stats().recovery_pending_keys == 0);
+    assert(store.size() == 19998);
+    assert(store.get("key7").value() == "live");
+    assert(!store.get("key8").has_value());
+    assert(store.get("key12345").value() == "value12345");
+    
+    std::remove(wal_path.c_str());
+    
+    std::cout << "✓ test_progressive_recovery passed" << std::endl;
+}
+
+// Test copy-on-write snapshots taken while writers keep going
+void test_snapshot() {
+    std::cout << "Running test_snapshot..." << std::endl;
+    
+    const std::string path = "test_snapshot.snap";
+    std::remove(path.c_str());
+    StoreOptions options;
+    options.max_capacity = 100000;
+    options.compress_values = true;
+    
+    // Over 3 MB of records at 10 MB/s: the writes below land while the scan is under way
+    auto value_of = [](int i) { return "value" + std::to_string(i) + std::string(100, 'v'); };
+    KVStore store(options);
+    for (int i = 0; i < 30000; ++i) {
+        store.put("key" + std::to_string(i), value_of(i));
+    }
+    
+    auto done = store.snapshot(path, 10 * 1024 * 1024);
+    assert(!store.snapshot(path).get()); // One at a time
+    for (int i = 0; i < 1000; ++i) {
+        store.put("key" + std::to_string(i), "changed");
+        store.del("key" + std::to_string(1000 + i));
+        store.put("new" + std::to_string(i), "value");
+    }
+    assert(done.get());
+    assert(store.stats().snapshot_cow_copies > 0);
+    
+    // The image is the store as of the snapshot() call
+    {
+        KVStore loaded(options);
+        assert(loaded.load_snapshot(path));
+        assert(loaded.size() == 30000);
+        assert(loaded.get("key0").value() == value_of(0));
+        assert(loaded.get("key1500").value() == value_of(1500));
+        assert(loaded.get("key29999").value() == value_of(29999));
+        assert(!loaded.exists("new0"));
+    }
+    
+    // Snapshots that fail at once (no such directory) may finish before their starter has
+    // recorded the thread; concurrent starters still join it safely
+    {
+        std::vector<std::thread> starters;
+        for (int t = 0; t < 4; ++t) {
+            starters.emplace_back([&store] {
+                for (int i = 0; i < 50; ++i) {
+                    assert(!store.snapshot("no-such-dir/test.snap").get());
+                }
+            });
+        }
+        for (auto& starter : starters) {
+            starter.join();
+        }
+    }
+    
+    // Tables swapped out by clear() are still saved
+    done = store.snapshot(path);
+    store.clear();
+    assert(done.get());
+    {
+        KVStore loaded(options);
+        assert(loaded.load_snapshot(path));
+        assert(loaded.size() == 30000);
+        assert(loaded.get("key0").value() == "changed");
+        assert(!loaded.exists("key1500"));
+        assert(loaded.get("new999").value() == "value");
+    }
+    
+    // Deduplicated values are written once and referred to, compressed or not
+    for (bool compress : {true, false}) {
+        StoreOptions dedup = options;
+        dedup.dedup_values = true;
+        dedup.compress_values = compress;
+        KVStore shared(dedup);
+        const std::string common = "common" + std::string(1000, 'x') + value_of(7);
+        for (int i = 0; i < 2000; ++i) {
+            shared.put("key" + std::to_string(i), i % 2 == 0 ? common : value_of(i));
+        }
+        done = shared.snapshot(path);
+        shared.put("key0", "changed");
+        assert(done.get());
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        assert(static_cast<size_t>(file.tellg()) < 1000 * common.size() / 4);
+        
+        KVStore loaded(dedup);
+        assert(loaded.load_snapshot(path));
+        assert(loaded.size() == 2000);
+        assert(loaded.get("key0").value() == common);
+        assert(loaded.get("key1998").value() == common);
+        assert(loaded.get("key1999").value() == value_of(1999));
+        assert(loaded.stats().shared_values == shared.stats().shared_values);
+    }
+    std::remove(path.c_str());
+    
+    std::cout << "✓ test_snapshot passed" << std::endl;
+}
+
+// Test the segmented WAL: preallocation, recovery across segments and recycling
+void test_wal_segments() {
+    std::cout << "Running test_wal_segments..." << std::endl;
+    
+    const std::string wal_path = "test_segments.log";
+    const std::string snapshot_path = "test_segments.snap";
+    auto remove_log = [&]() {
+        for (const std::string& file : WalWriter::files(wal_path)) {
+            std::remove(file.c_str());
+        }
+        std::remove(snapshot_path.c_str());
+    };
+    [[maybe_unused]] auto file_size = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return static_cast<size_t>(file.tellg());
+    };
+    remove_log();
+    
+    StoreOptions options;
+    options.max_capacity = 10000;
+    options.wal_path = wal_path;
+    options.wal_segment_size = 4096;
+    
+    {
+        KVStore store(options);
+        for (int i = 0; i < 500; ++i) {
+            store.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        store.del("key1");
+    }
+    
+    // Every segment keeps its preallocated size; records never grow a file. Spares are
+    // prepared in the background, so only the segments holding records are counted
+    std::vector<std::string> files = WalWriter::files(wal_path);
+    size_t used = 0;
+    for (const std::string& file : files) {
+        std::string line;
+        used += WalReader(file).next(line) ? 1 : 0;
+        assert(file_size(file) == 4096);
+    }
+    assert(used >= 3); // About 10 KB of records
+    assert(files[0] == wal_path + ".000001");
+    
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 499);
+        assert(store.get("key499").value() == "value499");
+        assert(!store.exists("key1"));
+    }
+    {
+        KVStore store(options);
+        assert(store.recover_async());
+        assert(store.get("key0").value() == "value0");
+        while (store.recovering()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        assert(store.size() == 499);
+        
+        // A checkpoint recycles the segments it covers into spares
+        assert(store.checkpoint(snapshot_path).get());
+        assert(!std::ifstream(wal_path + ".000001").is_open());
+        store.put("after", "checkpoint");
+        store.del("key2");
+    }
+    {
+        KVStore store(options);
+        assert(store.load_snapshot(snapshot_path));
+        assert(store.recover());
+        assert(store.size() == 499);
+        assert(store.get("after").value() == "checkpoint");
+        assert(!store.exists("key2"));
+        assert(store.get("key3").value() == "value3");
+    }
+    remove_log();
+    
+    // Compressed records after a checkpoint still decode: each segment starts with the
+    // dictionaries, since the segment that first logged them has been recycled
+    auto record = [](int i) {
+        return "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i) + "\",\"active\":true}";
+    };
+    options.compress_values = true;
+    {
+        KVStore store(options);
+        for (int i = 0; i < 600; ++i) {
+            store.put("k" + std::to_string(i), record(i));
+        }
+        assert(store.train_dictionary(4096) == 1);
+        assert(store.checkpoint(snapshot_path).get());
+        for (int i = 0; i < 600; ++i) {
+            store.put("k" + std::to_string(i), record(i + 1000));
+        }
+    }
+    for (const std::string& file : WalWriter::files(wal_path)) {
+        WalReader reader(file);
+        std::string line;
+        assert(!reader.next(line) || line.compare(0, 7, "DICT 1 ") == 0);
+    }
+    {
+        KVStore store(options);
+        assert(store.load_snapshot(snapshot_path));
+        assert(store.recover());
+        assert(store.size() == 600);
+        assert(store.get("k550").value() == record(1550));
+    }
+    {
+        KVStore store(options);
+        assert(store.recover_async());
+        assert(store.get("k550").value() == record(1550));
+    }
+    remove_log();
+    
+    std::cout << "✓ test_wal_segments passed" << std::endl;
+}
+
+// Test the direct-I/O WAL: framed 4 KB blocks, double-buffered writes and torn-block skipping
+void test_direct_wal() {
+    std::cout << "Running test_direct_wal..." << std::endl;
+    
+    const std::string wal_path = "test_direct.log";
+    auto remove_log = [&]() {
+        for (const std::string& file : WalWriter::files(wal_path)) {
+            std::remove(file.c_str());
+        }
+    };
+    [[maybe_unused]] auto file_size = [](const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return static_cast<size_t>(file.tellg());
+    };
+    auto value_of = [](int i) { return "value" + std::to_string(i) + std::string(100, 'v'); };
+    remove_log();
+    
+    StoreOptions options;
+    options.max_capacity = 10000;
+    options.wal_path = wal_path;
+    options.wal_direct_io = true;
+    options.wal_durability = WalDurability::Buffered;
+    
+    // Over 200 KB of records: several buffers go to the I/O thread while the other fills
+    {
+        KVStore store(options);
+        for (int i = 0; i < 2000; ++i) {
+            store.put("key" + std::to_string(i), value_of(i));
+        }
+        store.del("key1");
+    }
+    // Flushed records are packed into the last block rather than padded out one per
+    // block, so the log grows with its payload (plus a shadow block)
+    options.wal_durability = WalDurability::Flush;
+    [[maybe_unused]] size_t buffered_size = file_size(wal_path);
+    [[maybe_unused]] size_t payload = 0;
+    {
+        KVStore store(options);
+        for (int i = 0; i < 1000; ++i) {
+            std::string key = "flushed" + std::to_string(i);
+            store.put(key, "a");
+            payload += ("PUT " + key + " a\n").size();
+        }
+    }
+    assert(file_size(wal_path) % 4096 == 0);
+    assert(file_size(wal_path) - buffered_size <= payload + 2 * 4096);
+    {
+        std::ifstream file(wal_path, std::ios::binary);
+        char magic[4];
+        file.read(magic, 4);
+        assert(std::string(magic, 4) == "KVWB");
+    }
+    
+    // Text records are never appended to a framed file, nor the other way round
+    assert(!WalWriter::open(wal_path, 0, WalDurability::Flush, false));
+    assert(WalWriter::open(wal_path, 0, WalDurability::Flush, true));
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 2999);
+        assert(!store.exists("key1"));
+        assert(store.get("key1999").value() == value_of(1999));
+        assert(store.get("flushed999").value() == "a");
+    }
+    {
+        KVStore store(options);
+        assert(store.recover_async());
+        assert(store.get("key1000").value() == value_of(1000));
+        while (store.recovering()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        assert(store.size() == 2999);
+    }
+    
+    // A block torn by a crash loses only the records touching it
+    {
+        std::fstream file(wal_path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(4096 * 10 + 100);
+        file.put('X');
+    }
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() > 2950 && store.size() < 2999);
+        assert(store.get("key0").value() == value_of(0));
+        assert(store.get("key1999").value() == value_of(1999));
+        assert(store.get("flushed1").value() == "a");
+    }
+    remove_log();
+    
+    // The second flush of a partial block goes to the shadow slot after it, so tearing
+    // the first image loses nothing
+    {
+        KVStore store(options);
+        store.put("first", "1");
+        store.put("second", "2");
+    }
+    assert(file_size(wal_path) == 2 * 4096);
+    {
+        std::fstream file(wal_path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(100);
+        file.put('X');
+    }
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 2);
+        assert(store.get("first").value() == "1");
+        assert(store.get("second").value() == "2");
+    }
+    remove_log();
+    
+    // Concurrent writers wait for their records outside the store lock and share the writes
+    options.wal_durability = WalDurability::Sync;
+    {
+        KVStore store(options);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&store, t] {
+                for (int i = 0; i < 100; ++i) {
+                    store.put("writer" + std::to_string(t) + "-" + std::to_string(i), "v");
+                }
+            });
+        }
+        for (std::thread& writer : writers) {
+            writer.join();
+        }
+    }
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 400);
+        assert(store.get("writer3-99").value() == "v");
+    }
+    remove_log();
+    options.wal_durability = WalDurability::Flush;
+    
+    // Segments are whole blocks and no record crosses into the next one
+    options.wal_segment_size = 16384;
+    {
+        KVStore store(options);
+        for (int i = 0; i < 300; ++i) {
+            store.put("key" + std::to_string(i), value_of(i));
+        }
+    }
+    // Spares are prepared in the background, so only the segments holding records are counted
+    size_t used = 0;
+    for (const std::string& file : WalWriter::files(wal_path)) {
+        std::string line;
+        used += WalReader(file).next(line) ? 1 : 0;
+        assert(file_size(file) == 16384);
+    }
+    assert(used >= 3); // About 36 KB of records
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 300);
+        assert(store.get("key299").value() == value_of(299));
+    }
+    
+    // A segmented log continues in a fresh segment, so it may switch format
+    options.wal_direct_io = false;
+    {
+        KVStore store(options);
+        store.put("text", "record");
+    }
+    {
+        KVStore store(options);
+        assert(store.recover());
+        assert(store.size() == 301);
+        assert(store.get("text").value() == "record");
+    }
+    remove_log();
+    
+    // A failed write is reported rather than dropped silently
+    {
+        StoreOptions full;
+        full.wal_path = "/dev/full";
+        KVStore store(full);
+        assert(!store.stats().wal_failed);
+        store.put("key", "value");
+        assert(store.stats().wal_failed);
+        assert(store.get("key").value() == "value");
+    }
+    
+    std::cout << "✓ test_direct_wal passed" << std::endl;
+}
+
 // Test performance (basic benchmark)
 void test_performance() {
     std::cout << "Running test_performance..." << std::endl;
@@ -216,6 +2014,31 @@ int main() {
         test_clear();
         test_thread_safety();
         test_wal_recovery();
+        test_get_or_load();
+        test_ttl_refresh();
+        test_negative_cache();
+        test_gdsf_eviction();
+        test_background_eviction();
+        test_async_clear();
+        test_namespaces();
+        test_tenant_scheduler();
+        test_hot_keys();
+        test_hot_key_replication();
+        test_numa_arena();
+        test_huge_pages();
+        test_active_defrag();
+        test_cold_tier();
+        test_dictionary_compression();
+        test_inline_storage();
+        test_value_dedup();
+        test_fingerprint_keys();
+        test_key_filter();
+        test_shared_memory();
+        test_persistent_table();
+        test_progressive_recovery();
+        test_snapshot();
+        test_wal_segments();
+        test_direct_wal();
         test_performance();
         
         std::cout << std::endl << "=== All tests passed! ===" << std::endl;